@@ -0,0 +1,189 @@
+// Copyright 2024 The Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef GOINCPP_BUFIO_WRITER_HPP
+#define GOINCPP_BUFIO_WRITER_HPP
+
+#include <cstddef>
+#include <cstring>
+#include <istream>
+#include <new>
+#include <string_view>
+
+#include "../errors/errors.hpp"
+#include "../io/writer.hpp"
+
+namespace goincpp {
+namespace bufio {
+
+// Writer implements buffering for an io::Writer. Small writes are copied
+// into the buffer and reach the underlying writer in one call once it is
+// full or on Flush; writes at least as large as the buffer skip it when it
+// is empty.
+//
+// If an error occurs writing to a Writer, no more data will be accepted and
+// all subsequent writes, and Flush, will return the error. After all data
+// has been written, the client should call the Flush method to guarantee
+// all data has been forwarded to the underlying io::Writer; the destructor
+// does not flush.
+//
+// A Writer may not be used by multiple threads simultaneously.
+class Writer {
+public:
+    static constexpr std::size_t defaultBufSize = 4096;
+    static constexpr std::size_t defaultAlign = 64;
+
+    // Writer buffers w with a buffer of at least size bytes, aligned to
+    // align, which must be a power of two. The size is rounded up to a
+    // multiple of align; zero means defaultBufSize.
+    explicit Writer(io::Writer& w, std::size_t size = defaultBufSize, std::size_t align = defaultAlign)
+        : _w(&w), _align(align) {
+        if (size == 0) {
+            size = defaultBufSize;
+        }
+        _size = (size + align - 1) & ~(align - 1);
+        _buf = static_cast<char*>(::operator new(_size, std::align_val_t(_align)));
+    }
+
+    Writer(const Writer&) = delete;
+    Writer& operator=(const Writer&) = delete;
+
+    ~Writer() {
+        ::operator delete(_buf, std::align_val_t(_align));
+    }
+
+    // Size returns the size of the underlying buffer in bytes.
+    std::size_t Size() const { return _size; }
+
+    // Available returns how many bytes are unused in the buffer.
+    std::size_t Available() const { return _size - _n; }
+
+    // Buffered returns the number of bytes that have been written into the
+    // current buffer.
+    std::size_t Buffered() const { return _n; }
+
+    // Reset discards any unflushed buffered data, clears any error, and
+    // resets the Writer to write its output to w.
+    void Reset(io::Writer& w) {
+        _w = &w;
+        _n = 0;
+        _err = nullptr;
+    }
+
+    // Flush writes any buffered data to the underlying io::Writer.
+    Error Flush() {
+        if (_err) {
+            return _err;
+        }
+        if (_n == 0) {
+            return nullptr;
+        }
+        if (!forward(_buf, _n)) {
+            return _err;
+        }
+        _n = 0;
+        return nullptr;
+    }
+
+    // Write writes the n bytes at p into the buffer. It returns an error if
+    // fewer than n bytes were accepted, and stores the number accepted in
+    // *nn if given.
+    Error Write(const void* p, std::size_t n, std::size_t* nn = nullptr) {
+        auto data = static_cast<const char*>(p);
+        std::size_t written = 0;
+        while (n > Available() && !_err) {
+            std::size_t m;
+            if (_n == 0) {
+                // Large write, empty buffer: write directly to avoid a copy.
+                if (!forward(data, n)) {
+                    break;
+                }
+                m = n;
+            } else {
+                m = Available();
+                std::memcpy(_buf + _n, data, m);
+                _n += m;
+                Flush();
+            }
+            written += m;
+            data += m;
+            n -= m;
+        }
+        if (!_err && n > 0) {
+            std::memcpy(_buf + _n, data, n);
+            _n += n;
+            written += n;
+        }
+        if (nn) {
+            *nn = written;
+        }
+        return _err;
+    }
+
+    // WriteByte writes a single byte.
+    Error WriteByte(char c) {
+        if (_err) {
+            return _err;
+        }
+        if (_n == _size && Flush()) {
+            return _err;
+        }
+        _buf[_n++] = c;
+        return nullptr;
+    }
+
+    // WriteString writes a string. It returns an error if fewer than
+    // s.size() bytes were accepted.
+    Error WriteString(std::string_view s, std::size_t* nn = nullptr) {
+        return Write(s.data(), s.size(), nn);
+    }
+
+    // ReadFrom reads r until EOF or error, reading straight into the free
+    // part of the buffer and flushing it whenever it fills up, so the data
+    // is copied once. The number of bytes read is stored in *nn if given.
+    // Reaching EOF is not an error.
+    Error ReadFrom(std::istream& r, std::size_t* nn = nullptr) {
+        std::size_t total = 0;
+        while (!_err) {
+            if (_n == _size && Flush()) {
+                break;
+            }
+            r.read(_buf + _n, static_cast<std::streamsize>(Available()));
+            auto m = static_cast<std::size_t>(r.gcount());
+            _n += m;
+            total += m;
+            if (!r) {
+                break;
+            }
+        }
+        if (nn) {
+            *nn = total;
+        }
+        return _err;
+    }
+
+private:
+    // forward passes n bytes to the underlying writer, recording a failure
+    // of its stream as the sticky error.
+    bool forward(const char* p, std::size_t n) {
+        _w->WriteBytes(p, n);
+        if (!_w->GetStream()) {
+            _err = io::errShortWrite;
+            return false;
+        }
+        return true;
+    }
+
+    io::Writer* _w;
+    char* _buf;
+    std::size_t _size;
+    std::size_t _align;
+    std::size_t _n = 0;
+    Error _err;
+};
+
+}
+}
+
+#endif // GOINCPP_BUFIO_WRITER_HPP
@@ -0,0 +1,134 @@
+// Copyright 2024 The Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef GOINCPP_CONTEXT_ARENA_HPP
+#define GOINCPP_CONTEXT_ARENA_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+
+namespace goincpp {
+namespace context {
+
+// ContextArena is a bump allocator for the contexts of one request. It is a
+// single block of memory, its own bookkeeping included, handed out front to
+// back and never reused: every allocation holds a reference, and the whole
+// block is freed at once when the last one is released. Allocations that do
+// not fit get a block of their own, freed along with the arena.
+//
+// ContextArena may be used by multiple threads simultaneously.
+class ContextArena {
+public:
+    static constexpr std::size_t defaultSize = 2048;
+
+    // create allocates an arena with room for size bytes. The caller holds
+    // one reference.
+    static ContextArena* create(std::size_t size = defaultSize) {
+        std::size_t header = (sizeof(ContextArena) + maxAlign - 1) & ~(maxAlign - 1);
+        void* mem = ::operator new(header + size, std::align_val_t(maxAlign));
+        char* base = static_cast<char*>(mem);
+        return new (mem) ContextArena(base + header, base + header + size);
+    }
+
+    void* allocate(std::size_t n, std::size_t align) {
+        char* cur = _cursor.load(std::memory_order_relaxed);
+        for (;;) {
+            auto p = (reinterpret_cast<std::uintptr_t>(cur) + align - 1) & ~(std::uintptr_t(align) - 1);
+            char* next = reinterpret_cast<char*>(p) + n;
+            if (next > _end || align > maxAlign) {
+                return allocateOverflow(n, align);
+            }
+            if (_cursor.compare_exchange_weak(cur, next, std::memory_order_relaxed)) {
+                return reinterpret_cast<char*>(p);
+            }
+        }
+    }
+
+    void ref() { _refs.fetch_add(1, std::memory_order_relaxed); }
+
+    void unref() {
+        if (_refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            destroy();
+        }
+    }
+
+private:
+    static constexpr std::size_t maxAlign = 64;
+
+    // Overflow is the header of a block allocated past the end.
+    struct Overflow {
+        Overflow* next;
+        std::size_t align;
+    };
+
+    ContextArena(char* begin, char* end) : _cursor(begin), _end(end) {}
+
+    void* allocateOverflow(std::size_t n, std::size_t align) {
+        if (align < alignof(Overflow)) {
+            align = alignof(Overflow);
+        }
+        std::size_t header = (sizeof(Overflow) + align - 1) & ~(align - 1);
+        void* mem = ::operator new(header + n, std::align_val_t(align));
+        auto o = new (mem) Overflow{nullptr, align};
+        std::lock_guard<std::mutex> lock(_mu);
+        o->next = _overflow;
+        _overflow = o;
+        return static_cast<char*>(mem) + header;
+    }
+
+    void destroy() {
+        for (Overflow* o = _overflow; o; ) {
+            Overflow* next = o->next;
+            ::operator delete(o, std::align_val_t(o->align));
+            o = next;
+        }
+        this->~ContextArena();
+        ::operator delete(this, std::align_val_t(maxAlign));
+    }
+
+    std::atomic<std::size_t> _refs{1};
+    std::atomic<char*> _cursor;
+    char* const _end;
+    std::mutex _mu;
+    Overflow* _overflow = nullptr;
+};
+
+// ArenaAllocator allocates from a ContextArena for std::allocate_shared.
+// Every copy holds a reference to the arena, so the memory of an object
+// outlives its control block, which keeps the allocator to the end.
+// deallocate does nothing: the arena frees everything at once.
+template <typename T>
+class ArenaAllocator {
+public:
+    using value_type = T;
+
+    explicit ArenaAllocator(ContextArena* arena) : _arena(arena) { _arena->ref(); }
+    ArenaAllocator(const ArenaAllocator& other) : _arena(other._arena) { _arena->ref(); }
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : _arena(other.arena()) { _arena->ref(); }
+    ArenaAllocator& operator=(const ArenaAllocator&) = delete;
+    ~ArenaAllocator() { _arena->unref(); }
+
+    T* allocate(std::size_t n) {
+        return static_cast<T*>(_arena->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T*, std::size_t) {}
+
+    ContextArena* arena() const { return _arena; }
+
+    template <typename U>
+    bool operator==(const ArenaAllocator<U>& other) const { return _arena == other.arena(); }
+
+private:
+    ContextArena* _arena;
+};
+
+}
+}
+
+#endif // GOINCPP_CONTEXT_ARENA_HPP
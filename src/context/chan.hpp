@@ -0,0 +1,80 @@
+// Copyright 2024 The Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef GOINCPP_CONTEXT_CHAN_HPP
+#define GOINCPP_CONTEXT_CHAN_HPP
+
+#include <memory>
+#include <utility>
+
+#include "context.hpp"
+#include "../runtime/select.hpp"
+
+namespace goincpp {
+namespace context {
+
+// Channel operations that give up when a context is canceled. Each one is a
+// select between the operation and ctx->done(), so it blocks once and wakes
+// up on whichever happens first, without polling ctx->err(). As with
+// select, if both are ready at once either may be chosen. A context that
+// can never be canceled makes them plain blocking operations.
+
+// receive receives from ch into value. It returns nullptr once a value was
+// received, or ch is closed and drained, in which case ok, if given, is set
+// to false. If ctx is canceled first, it returns ctx->err() and leaves value
+// alone.
+//
+//	int v;
+//	if (auto err = context::receive(ctx, ch, v)) {
+//		return err;
+//	}
+template <typename T, int Capacity, typename Policy>
+Error receive(const std::shared_ptr<Context>& ctx,
+              const std::shared_ptr<runtime::Channel<T, Capacity, Policy>>& ch,
+              T& value, bool* ok = nullptr) {
+    bool received = true;
+    if (runtime::select(runtime::caseRecv(ch, value, received),
+                        runtime::caseRecv(ctx->done())) == 1) {
+        return ctx->err();
+    }
+    if (ok) {
+        *ok = received;
+    }
+    return nullptr;
+}
+
+// receive on a signal channel waits for a signal, or for ch to be closed.
+template <typename Policy>
+Error receive(const std::shared_ptr<Context>& ctx,
+              const std::shared_ptr<runtime::Channel<runtime::Signal, 0, Policy>>& ch) {
+    if (runtime::select(runtime::caseRecv(ch),
+                        runtime::caseRecv(ctx->done())) == 1) {
+        return ctx->err();
+    }
+    return nullptr;
+}
+
+// send sends value on ch. It returns nullptr once ch accepted value, or if
+// ch is closed, in which case value is dropped and ok, if given, is set to
+// false. If ctx is canceled first, it returns ctx->err() and value is not
+// sent.
+template <typename T, int Capacity, typename Policy>
+Error send(const std::shared_ptr<Context>& ctx,
+           const std::shared_ptr<runtime::Channel<T, Capacity, Policy>>& ch,
+           T value, bool* ok = nullptr) {
+    bool sent = true;
+    if (runtime::select(runtime::caseSend(ch, std::move(value), sent),
+                        runtime::caseRecv(ctx->done())) == 1) {
+        return ctx->err();
+    }
+    if (ok) {
+        *ok = sent;
+    }
+    return nullptr;
+}
+
+}
+}
+
+#endif // GOINCPP_CONTEXT_CHAN_HPP
@@ -3,15 +3,21 @@
 // license that can be found in the LICENSE file.
 
 #include "context.hpp"
+#include "../runtime/task.hpp"
+#include <cerrno>
+#include <cstdint>
 #include <exception>
 
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
+
 namespace goincpp {
 namespace context {
 
 // Forward declarations
 static std::pair<std::shared_ptr<CancelCtx>, bool> parentCancelCtx(std::shared_ptr<Context> parent);
-static std::optional<std::any> value(std::shared_ptr<Context> c, const void* key);
-static void removeChild(std::shared_ptr<Context> parent, std::shared_ptr<Canceler> child);
 
 std::string
 stringify(const std::any& v) {
@@ -65,17 +71,21 @@ parentCancelCtx(std::shared_ptr<Context> parent) {
         return { nullptr, false };
     }
 
-    auto p = parent->value((void*)&CancelCtx::cancelCtxKey);
-    if (!p) {
-        return { nullptr, false };
-    }
-
-    std::any pV = p.value();
-    if (pV.type() != typeid(std::shared_ptr<CancelCtx>)) {
+    // Built-in chains are resolved with lookup, which does not box the
+    // cancelCtx into a std::any.
+    std::shared_ptr<CancelCtx> pCanelCtx;
+    Context* other = nullptr;
+    if (Context* found = parent->lookup(&CancelCtx::cancelCtxKey, &other)) {
+        pCanelCtx = dynamic_cast<CancelCtx*>(found)->shared_from_this();
+    } else if (other != nullptr) {
+        auto p = other->value((void*)&CancelCtx::cancelCtxKey);
+        if (!p || p.value().type() != typeid(std::shared_ptr<CancelCtx>)) {
+            return { nullptr, false };
+        }
+        pCanelCtx = std::any_cast<std::shared_ptr<CancelCtx>>(p.value());
+    } else {
         return { nullptr, false };
     }
-
-    auto pCanelCtx = std::any_cast<std::shared_ptr<CancelCtx>>(pV);
     auto pDone = pCanelCtx->done();
     if (pDone != done) {
         return { nullptr, false };
@@ -83,23 +93,15 @@ parentCancelCtx(std::shared_ptr<Context> parent) {
     return { pCanelCtx, true };
 }
 
-static void
-removeChild(std::shared_ptr<Context> parent, std::shared_ptr<Canceler> child) {
-    auto [p, ok] = parentCancelCtx(parent);
-    if (!ok) {
-        return;
-    }
-
-    std::lock_guard<std::mutex> lock(p->mu());
-    if (!p->children().empty()) {
-        p->children().erase(child);
-    }
-}
-
 Error canceledError = goincpp::errors::newError("context canceled");
 Error deadlineExceededError = goincpp::errors::newError<DeadlineExceededError>("context deadline exceeded");
 
-std::shared_ptr<UnbufferedChannel> closedChan = UnbufferedChannel::make();
+// closedChan is a reusable closed channel.
+std::shared_ptr<UnbufferedChannel> closedChan = []() {
+    auto c = UnbufferedChannel::make();
+    c->close();
+    return c;
+}();
 
 int CancelCtx::cancelCtxKey = 0;
 
@@ -112,11 +114,60 @@ CancelCtx::done() {
     std::lock_guard<std::mutex> lock(_mu);
     d = _done.load();
     if (d == nullptr) {
-        _done.store(UnbufferedChannel::make());
+        if (_arena) {
+            d = std::allocate_shared<UnbufferedChannel>(ArenaAllocator<UnbufferedChannel>(_arena));
+        } else {
+            d = UnbufferedChannel::make();
+        }
+        _done.store(d);
     }
     return _done.load();
 }
 
+#if defined(__linux__)
+
+// signalDoneFd makes fd readable for good.
+static void
+signalDoneFd(int fd) {
+    uint64_t one = 1;
+    ssize_t n;
+    do {
+        n = write(fd, &one, sizeof(one));
+    } while (n < 0 && errno == EINTR);
+}
+
+int
+CancelCtx::doneFd() {
+    int fd = _doneFd.load(std::memory_order_acquire);
+    if (fd >= 0) {
+        return fd;
+    }
+    std::lock_guard<std::mutex> lock(_mu);
+    fd = _doneFd.load(std::memory_order_relaxed);
+    if (fd < 0) {
+        fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (fd < 0) {
+            return -1;
+        }
+        if (_err) {
+            signalDoneFd(fd);
+        }
+        _doneFd.store(fd, std::memory_order_release);
+    }
+    return fd;
+}
+
+#else // __linux__
+
+static void signalDoneFd(int fd) {}
+
+int
+CancelCtx::doneFd() {
+    return -1;
+}
+
+#endif // __linux__
+
 std::optional<std::any>
 CancelCtx::value(const void* key) {
     if (key == (void*)&CancelCtx::cancelCtxKey) {
@@ -125,19 +176,135 @@ CancelCtx::value(const void* key) {
     return context::value(_parent, key);
 }
 
+struct CancelCtx::Children {
+    static constexpr int shards = 8;
+
+    struct alignas(runtime::cacheLinePadSize) Shard {
+        std::mutex mu;
+        CancelCtx* first = nullptr;
+        // closed is set once the parent detached its children on cancel;
+        // no child may be added afterwards.
+        bool closed = false;
+    };
+
+    Shard& shard(const CancelCtx* child) {
+        auto h = reinterpret_cast<std::uintptr_t>(child) / alignof(std::max_align_t);
+        return _shards[h % shards];
+    }
+
+    Shard _shards[shards];
+};
+
+CancelCtx::~CancelCtx() {
+    if (auto c = _children.load(std::memory_order_relaxed)) {
+        if (_arena) {
+            c->~Children();
+        } else {
+            delete c;
+        }
+    }
+#if defined(__linux__)
+    int fd = _doneFd.load(std::memory_order_relaxed);
+    if (fd >= 0) {
+        close(fd);
+    }
+#endif
+    releaseParent(_parent);
+}
+
+CancelCtx::Children*
+CancelCtx::children() {
+    auto c = _children.load(std::memory_order_acquire);
+    if (c != nullptr) {
+        return c;
+    }
+    Children* fresh;
+    if (_arena) {
+        fresh = new (_arena->allocate(sizeof(Children), alignof(Children))) Children;
+    } else {
+        fresh = new Children;
+    }
+    if (_children.compare_exchange_strong(c, fresh, std::memory_order_acq_rel)) {
+        return fresh;
+    }
+    if (_arena) {
+        // The memory stays with the arena.
+        fresh->~Children();
+    } else {
+        delete fresh;
+    }
+    return c;
+}
+
+bool
+CancelCtx::addChild(CancelCtx* child) {
+    auto& s = children()->shard(child);
+    std::lock_guard<std::mutex> lock(s.mu);
+    if (s.closed) {
+        return false;
+    }
+    child->_prevSibling = nullptr;
+    child->_nextSibling = s.first;
+    if (s.first) {
+        s.first->_prevSibling = child;
+    }
+    s.first = child;
+    child->_linked = true;
+    child->_self = child->shared_from_this();
+    return true;
+}
+
+void
+CancelCtx::removeChild(CancelCtx* child) {
+    std::shared_ptr<CancelCtx> self;
+    do {
+        auto& s = children()->shard(child);
+        std::lock_guard<std::mutex> lock(s.mu);
+        if (!child->_linked) {
+            // Already detached by a cancel of c.
+            return;
+        }
+        if (child->_prevSibling) {
+            child->_prevSibling->_nextSibling = child->_nextSibling;
+        } else {
+            s.first = child->_nextSibling;
+        }
+        if (child->_nextSibling) {
+            child->_nextSibling->_prevSibling = child->_prevSibling;
+        }
+        child->_prevSibling = child->_nextSibling = nullptr;
+        child->_linked = false;
+        // Released once the shard is unlocked.
+        self = std::move(child->_self);
+    } while(0);
+}
+
+// watchParent cancels child once parent is canceled, for a parent without a
+// cancelCtx to register with. It is the goroutine Go starts for such a
+// parent, as a Task: only its suspended frame waits, on no thread. Like the
+// children list of a cancelCtx, it keeps child alive until then, even if
+// child is canceled first.
+static runtime::Task
+watchParent(std::shared_ptr<UnbufferedChannel> done, std::shared_ptr<Context> parent,
+            std::shared_ptr<Canceler> child) {
+    co_await done;
+    child->cancel(false, parent->err(), context::cause(parent));
+}
+
 // propagateCancel arranges for child to be canceled when parent is.
 // It sets the parent context of cancelCtx.
 void
 CancelCtx::propagateCancel(std::shared_ptr<Context> parent,
                            std::shared_ptr<Canceler> child) {
     _parent = parent;
+    _parentCtx = parent.get();
 
     auto done = parent->done();
     if (done == nullptr) {
         return; // parent is never canceled
     }
 
-    if (done->select()) {
+    if (done->closed()) {
         // parent is already canceled
         child->cancel(false, parent->err(), context::cause(parent));
         return;
@@ -146,31 +313,25 @@ CancelCtx::propagateCancel(std::shared_ptr<Context> parent,
     auto [p, ok] = parentCancelCtx(parent);
     if (ok) {
         // parent is a *cancelCtx, or derives from one.
-        p->mu().lock();
-        if (p->err() != nullptr) {
+        _cancelParent = p.get();
+        if (!p->addChild(this)) {
             // parent has already been canceled
             child->cancel(false, p->err(), p->cause());
-        } else {
-            p->children().clear();
         }
-        p->mu().unlock();
         return;
     }
-}
 
-void
-CancelCtx::cancel(bool removeFromParent, Error err, Error cause) {
-    if (err == nullptr) {
-        throw std::invalid_argument("context: internal error: missing cancel error");
-    }
-    if (cause == nullptr) {
-        cause = err;
-    }
+    // parent is cancelable, but not by a cancelCtx we know of: a Context
+    // of its own, or one wrapping a cancelCtx with another done channel.
+    runtime::spawn(watchParent(std::move(done), parent, child));
+}
 
+bool
+CancelCtx::markCanceled(Error err, Error cause, std::vector<std::shared_ptr<CancelCtx>>& pending) {
     do {
         std::lock_guard<std::mutex> lock(_mu);
         if (_err) {
-            return; // already canceled
+            return false; // already canceled
         }
 
         _err = err;
@@ -182,16 +343,80 @@ CancelCtx::cancel(bool removeFromParent, Error err, Error cause) {
         } else {
             d->close();
         }
-
-        for (auto& child : _children) {
-            // Cancel child cancelers if any
-            child->cancel(false, err, cause);
+        int fd = _doneFd.load(std::memory_order_relaxed);
+        if (fd >= 0) {
+            signalDoneFd(fd);
         }
-        _children.clear();
     } while(0);
 
-    if (removeFromParent) {
-        removeChild(_parent, shared_from_this());
+    // Children added from now on see a closed shard and cancel themselves,
+    // so none is missed. Only pointers are moved under the shard locks.
+    auto c = _children.load(std::memory_order_acquire);
+    if (c == nullptr) {
+        return true;
+    }
+    for (auto& s : c->_shards) {
+        std::lock_guard<std::mutex> lock(s.mu);
+        s.closed = true;
+        for (CancelCtx* child = s.first; child; ) {
+            CancelCtx* next = child->_nextSibling;
+            child->_prevSibling = child->_nextSibling = nullptr;
+            child->_linked = false;
+            pending.push_back(std::move(child->_self));
+            child = next;
+        }
+        s.first = nullptr;
+    }
+    return true;
+}
+
+void
+CancelCtx::cancel(bool removeFromParent, Error err, Error cause) {
+    if (err == nullptr) {
+        throw std::invalid_argument("context: internal error: missing cancel error");
+    }
+    if (cause == nullptr) {
+        cause = err;
+    }
+
+    std::vector<std::shared_ptr<CancelCtx>> pending;
+    if (!markCanceled(err, cause, pending)) {
+        return;
+    }
+    if (removeFromParent && _cancelParent) {
+        _cancelParent->removeChild(this);
+    }
+    canceled();
+
+    // Descendants are canceled from an explicit stack rather than by
+    // recursion, so neither deep nor wide trees are bounded by the call
+    // stack, and no lock is held while a child is canceled.
+    while (!pending.empty()) {
+        auto child = std::move(pending.back());
+        pending.pop_back();
+        if (child->markCanceled(err, cause, pending)) {
+            child->canceled();
+        }
+    }
+}
+
+bool
+AfterFuncCtx::stop() {
+    if (_once.exchange(true, std::memory_order_acq_rel)) {
+        return false;
+    }
+    // Unlinks the registration from its parent and drops f.
+    cancel(true, canceledError, nullptr);
+    return true;
+}
+
+void
+AfterFuncCtx::canceled() {
+    // canceled runs once per context, so _f is not touched concurrently.
+    auto f = std::move(_f);
+    _f = nullptr;
+    if (!_once.exchange(true, std::memory_order_acq_rel)) {
+        runtime::defaultExecutor().post(std::move(f));
     }
 }
 
@@ -200,6 +425,36 @@ WithoutCancelCtx::value(const void* key) {
     return context::value(shared_from_this(), key);
 }
 
+void
+TimerCtx::arm(Error cause) {
+    _deadlineCause = std::move(cause);
+    _armed = std::static_pointer_cast<TimerCtx>(shared_from_this());
+    _timer.startAt(_deadline, [this]() {
+        // Released once c is canceled.
+        auto self = std::move(_armed);
+        cancel(true, deadlineExceededError, _deadlineCause);
+    });
+    // A cancel racing with startAt may have stopped the timer before it
+    // was started.
+    if (err() != nullptr) {
+        canceled();
+    }
+}
+
+void
+TimerCtx::canceled() {
+    // Only the party that stops a pending timer releases _armed; otherwise
+    // the callback does.
+    if (_timer.stop()) {
+        _armed.reset();
+    }
+}
+
+std::optional<std::any>
+ArenaCtx::value(const void* key) {
+    return context::value(_parent, key);
+}
+
 std::optional<std::any>
 ValueCtx::value(const void* key) {
     if (key == _key) {
@@ -213,11 +468,25 @@ ValueCtx::value(const void* key) {
 //
 
 std::shared_ptr<Context> background() {
-    return std::make_shared<BackgroundCtx>();
+    static const std::shared_ptr<Context> ctx = std::make_shared<BackgroundCtx>();
+    return ctx;
 }
 
 std::shared_ptr<Context> todo() {
-    return std::make_shared<TodoCtx>();
+    static const std::shared_ptr<Context> ctx = std::make_shared<TodoCtx>();
+    return ctx;
+}
+
+std::shared_ptr<Context>
+withArena(std::shared_ptr<Context> parent, std::size_t size) {
+    if (parent == nullptr) {
+        throw std::invalid_argument("cannot create context from nil parent");
+    }
+    ContextArena* arena = ContextArena::create(size);
+    auto c = std::allocate_shared<ArenaCtx>(ArenaAllocator<ArenaCtx>(arena), std::move(parent), arena);
+    // From now on the contexts allocated from the arena own it.
+    arena->unref();
+    return c;
 }
 
 static std::shared_ptr<CancelCtx>
@@ -225,7 +494,7 @@ _withCancel(std::shared_ptr<Context> parent) {
     if (parent == nullptr) {
         throw std::invalid_argument("cannot create context from nil parent");
     }
-    auto c = std::make_shared<CancelCtx>();
+    auto c = makeContext<CancelCtx>(parent.get());
     c->propagateCancel(parent, c);
     return c;
 }
@@ -247,33 +516,65 @@ withoutCancel(std::shared_ptr<Context> parent) {
     if (parent == nullptr) {
          throw std::invalid_argument("cannot create context from nil parent");
     }
-    return std::make_shared<WithoutCancelCtx>(parent);
+    return makeContext<WithoutCancelCtx>(parent.get(), parent);
 }
 
-std::pair<std::shared_ptr<Context>, CancelFunc>
-withDeadlineCause(std::shared_ptr<Context> parent,
-                  std::chrono::system_clock::time_point d,
-                  Error cause) {
+std::function<bool()>
+afterFunc(std::shared_ptr<Context> ctx, std::function<void()> f) {
+    if (ctx == nullptr) {
+        throw std::invalid_argument("cannot create context from nil parent");
+    }
+    auto a = makeContext<AfterFuncCtx>(ctx.get(), std::move(f));
+    a->propagateCancel(ctx, a);
+    return [a]() { return a->stop(); };
+}
+
+// withDeadlineAt implements withDeadlineCause. wallDeadline is d on the
+// system clock, if the caller gave it.
+static std::pair<std::shared_ptr<Context>, CancelFunc>
+withDeadlineAt(std::shared_ptr<Context> parent,
+               std::chrono::steady_clock::time_point d,
+               std::optional<std::chrono::system_clock::time_point> wallDeadline,
+               Error cause) {
     if (parent == nullptr) {
         throw std::invalid_argument("cannot create context from nil parent");
     }
-    auto pD = parent->deadline();
-    if (pD.has_value() && std::chrono::system_clock::now() < d) {
+    auto pD = parent->steadyDeadline();
+    if (pD.has_value() && *pD < d) {
         // The current deadline is already sooner than the new one.
         return withCancel(parent);
     }
-    auto c = std::make_shared<TimerCtx>(d);
+    auto c = makeContext<TimerCtx>(parent.get(), d, wallDeadline);
     c->propagateCancel(parent, c);
-    std::lock_guard<std::mutex> lock(c->mu());
+    if (time::expired(d)) {
+        // The deadline has already passed.
+        c->cancel(true, deadlineExceededError, cause);
+        return {c, [c] () { c->cancel(false, canceledError, nullptr); } };
+    }
     if (c->err() == nullptr) {
-        c->timer().start(time::util(d),
-                         [c, cause]() {
-                            c->cancel(true, deadlineExceededError, cause);
-                         });
+        c->arm(cause);
     }
     return {c, [c] () { c->cancel(true, canceledError, nullptr); } };
 }
 
+std::pair<std::shared_ptr<Context>, CancelFunc>
+withDeadlineCause(std::shared_ptr<Context> parent,
+                  std::chrono::steady_clock::time_point d,
+                  Error cause) {
+    return withDeadlineAt(parent, d, std::nullopt, cause);
+}
+
+std::pair<std::shared_ptr<Context>, CancelFunc>
+withDeadlineCause(std::shared_ptr<Context> parent,
+                  std::chrono::system_clock::time_point d,
+                  Error cause) {
+    // Timers run on the steady clock; the wall-clock deadline is only
+    // converted once, here.
+    auto steady = std::chrono::steady_clock::now() +
+        std::chrono::ceil<std::chrono::steady_clock::duration>(d - std::chrono::system_clock::now());
+    return withDeadlineAt(parent, steady, d, cause);
+}
+
 std::pair<std::shared_ptr<Context>, CancelFunc>
 withDeadline(std::shared_ptr<Context> parent,
              std::chrono::system_clock::time_point  d) {
@@ -281,13 +582,19 @@ withDeadline(std::shared_ptr<Context> parent,
 }
 
 std::pair<std::shared_ptr<Context>, CancelFunc>
-withTimeout(std::shared_ptr<Context> parent, std::chrono::system_clock::duration timeout) {
-    return withDeadline(parent, std::chrono::system_clock::now() + timeout);
+withDeadline(std::shared_ptr<Context> parent,
+             std::chrono::steady_clock::time_point d) {
+    return withDeadlineCause(parent, d, nullptr);
+}
+
+std::pair<std::shared_ptr<Context>, CancelFunc>
+withTimeout(std::shared_ptr<Context> parent, std::chrono::steady_clock::duration timeout) {
+    return withDeadline(parent, time::deadlineAfter(timeout));
 }
 
 std::pair<std::shared_ptr<Context>, CancelFunc>
-withTimeoutCause(std::shared_ptr<Context> parent, std::chrono::system_clock::duration timeout, Error cause) {
-    return withDeadlineCause(parent, std::chrono::system_clock::now() + timeout, cause);
+withTimeoutCause(std::shared_ptr<Context> parent, std::chrono::steady_clock::duration timeout, Error cause) {
+    return withDeadlineCause(parent, time::deadlineAfter(timeout), cause);
 }
 
 std::shared_ptr<Context>
@@ -301,44 +608,116 @@ withValue(std::shared_ptr<Context> parent, const void* key, size_t ksize, const
     // if (!(goincpp::reflect::is_comparable< (key.type()) >::value) ) {
     //     throw std::invalid_argument("key is not comparable");
     // }
-    return std::make_shared<ValueCtx>(parent, key, ksize, val);
+    return makeContext<ValueCtx>(parent.get(), parent, key, ksize, val);
 }
 
-static std::optional<std::any>
-value(std::shared_ptr<Context> c, const void* key) {
-    while (c) {
-        if (auto ctx = dynamic_cast<ValueCtx*>(c.get())) {
-            if (key == ctx->key()) {
-                return ctx->value();
-            }
-            c = ctx->parent();
-        } else if (auto ctx = dynamic_cast<CancelCtx*>(c.get())) {
-            if (key == (void*)&CancelCtx::cancelCtxKey) {
-                return c;
+void
+Context::releaseParent(std::shared_ptr<Context>& parent) {
+    auto p = std::move(parent);
+    // Once this is the last reference to p, nothing else can reach it:
+    // its children, and its parent while it is linked, each hold one.
+    while (p && p.use_count() == 1) {
+        // p is destroyed with no parent left to release.
+        p = p->takeParent();
+    }
+}
+
+bool
+Context::answers(const void* key) const {
+    switch (_kind) {
+    case ContextKind::value:
+    case ContextKind::typedValue:
+        return key == _valueKey;
+    case ContextKind::cancel:
+        return key == &CancelCtx::cancelCtxKey;
+    default:
+        return false;
+    }
+}
+
+Context*
+Context::lookup(const void* key, Context** other) {
+    auto& cache = valueCache(key);
+    Context* hit = cache.load(std::memory_order_acquire);
+    if (hit != nullptr && hit->answers(key)) {
+        return hit;
+    }
+
+    Context* found = nullptr;
+    Context* c = this;
+    while (c != nullptr && found == nullptr) {
+        switch (c->_kind) {
+        case ContextKind::value:
+        case ContextKind::typedValue:
+        case ContextKind::cancel:
+            if (c->answers(key)) {
+                found = c;
+                continue;
             }
-            c = ctx->parent();
-        } else if (auto ctx = dynamic_cast<WithoutCancelCtx*>(c.get())) {
-            if (key == (void*)&CancelCtx::cancelCtxKey) {
+            break;
+        case ContextKind::withoutCancel:
+            if (key == &CancelCtx::cancelCtxKey) {
                 // This implements Cause(ctx) == nil
-				// when ctx is created using WithoutCancel.
-                return std::nullopt;
+                // when ctx is created using WithoutCancel.
+                return nullptr;
             }
-            c = ctx->parent();
-        } else if (auto ctx = dynamic_cast<TimerCtx*>(c.get())) {
-            if (key == (void*)&CancelCtx::cancelCtxKey) {
-                return c;
+            break;
+        case ContextKind::arena:
+            break;
+        case ContextKind::empty:
+            return nullptr;
+        case ContextKind::other:
+            *other = c;
+            return nullptr;
+        }
+        c = c->_parentCtx;
+        if (c != nullptr) {
+            hit = c->valueCache(key).load(std::memory_order_acquire);
+            if (hit != nullptr && hit->answers(key)) {
+                found = hit;
             }
-            c = ctx->parent();
-        } else if (dynamic_cast<BackgroundCtx*>(c.get()) ||
-                   dynamic_cast<TodoCtx*>(c.get())) {
-            return std::nullopt;
-        } else {
-            return c->value(key);
         }
     }
+    if (found != nullptr) {
+        cache.store(found, std::memory_order_release);
+    }
+    return found;
+}
+
+const void*
+lookupValue(Context* c, const void* tag) {
+    while (c) {
+        Context* other = nullptr;
+        Context* next = nullptr;
+        if (Context* found = c->lookup(tag, &other)) {
+            return found->typedValue(tag, &next);
+        }
+        if (other == nullptr) {
+            return nullptr;
+        }
+        if (auto v = other->typedValue(tag, &next)) {
+            return v;
+        }
+        c = next;
+    }
+    return nullptr;
+}
 
+std::optional<std::any>
+value(std::shared_ptr<Context> c, const void* key) {
+    if (!c) {
+        return std::nullopt;
+    }
+    Context* other = nullptr;
+    if (Context* found = c->lookup(key, &other)) {
+        // found holds key itself, so this does not come back here.
+        return found->value(key);
+    }
+    if (other != nullptr) {
+        return other->value(key);
+    }
     return std::nullopt;
 }
 
 }
-}
\ No newline at end of file
+}
@@ -13,11 +13,15 @@
 #include <unordered_set>
 #include <optional>
 #include <any>
+#include <cstdint>
 #include <cstring>
+#include <limits>
 #include <cassert>
 
 #include "../errors/errors.hpp"
 #include "../runtime/chan.hpp"
+#include "arena.hpp"
+#include "../time/clock.hpp"
 #include "../time/timer.hpp"
 #include "../reflect/type.hpp"
 
@@ -96,6 +100,19 @@ public:
     virtual ~Stringer() = default;
 };
 
+// ContextKind tells the built-in contexts apart, so that value lookups can
+// walk a chain of them without dynamic_cast or virtual calls. Contexts
+// implemented elsewhere are of kind other.
+enum class ContextKind : uint8_t {
+    other,
+    empty,
+    cancel,
+    withoutCancel,
+    value,
+    typedValue,
+    arena,
+};
+
 // A Context carries a deadline, a cancellation signal, and other values across
 // API boundaries.
 //
@@ -104,11 +121,25 @@ class Context {
 public:
     virtual ~Context() = default;
 
+    ContextKind kind() const { return _kind; }
+
     // Deadline returns the time when work done on behalf of this context
 	// should be canceled. Deadline returns ok==false when no deadline is
 	// set. Successive calls to Deadline return the same results.
 	virtual std::optional<std::chrono::time_point<std::chrono::system_clock>> deadline() const = 0;
 
+    // steadyDeadline is Deadline on the steady clock, which is immune to
+    // wall-clock jumps and cheap to compare with time::CoarseClock::now().
+    // The built-in contexts keep their deadlines on the steady clock; for
+    // others it is converted from Deadline.
+    virtual std::optional<std::chrono::steady_clock::time_point> steadyDeadline() const {
+        auto d = deadline();
+        if (!d) {
+            return std::nullopt;
+        }
+        return std::chrono::steady_clock::now() + (*d - std::chrono::system_clock::now());
+    }
+
     // Done returns a channel that's closed when work done on behalf of this
     // context should be canceled. Done may return nil if this context can
 	// never be canceled. Successive calls to Done return the same value.
@@ -132,16 +163,86 @@ public:
 	// functions.
 	//
     virtual std::optional<std::any> value(const void* key) = 0;
+
+    // doneFd returns a file descriptor that becomes readable when the Done
+    // channel is closed, for use with poll, epoll or select. It returns -1
+    // if this context can never be canceled, or cannot be polled. The
+    // descriptor belongs to the context: it must not be read from, written
+    // to or closed, and stays readable once canceled.
+    virtual int doneFd() { return -1; }
+
+    // typedValue is one step of the lookup done by valueOf<Key>. It returns
+    // the value this context stores under tag, if any, and otherwise sets
+    // *next to the context to look at next, or to nullptr to end the walk.
+    // Contexts of kind other that derive from a parent override it to step
+    // to the parent.
+    virtual const void* typedValue(const void* /*tag*/, Context** next) {
+        *next = nullptr;
+        return nullptr;
+    }
+
+    // lookup resolves key starting at this context. It returns the built-in
+    // context that answers it: the value context holding key, or the
+    // nearest cancelCtx for &CancelCtx::cancelCtxKey. It returns nullptr if
+    // the chain does not have key, or if it reaches a context of kind
+    // other, which is then stored in *other to be asked directly.
+    //
+    // Each context caches the answers to its latest lookups, and the walk
+    // consults the cache of every ancestor it passes. Chains are immutable,
+    // so cached answers never go stale, and a lookup from a new context
+    // usually stops at its parent instead of walking to the root.
+    Context* lookup(const void* key, Context** other);
+
+    // arena returns the arena this context was allocated from, or nullptr.
+    // The built-in contexts derived from it are allocated from the same
+    // arena; see withArena.
+    ContextArena* arena() const { return _arena; }
+
+protected:
+    template <typename T, typename... Args>
+    friend std::shared_ptr<T> makeContext(Context* parent, Args&&... args);
+
+    // releaseParent drops parent, the reference a context holds to its
+    // parent, as its destructor does. Where that is the last reference, the
+    // reference the parent holds in turn is taken out first, and so on up
+    // the chain: destroying a chain of any depth then frees its contexts
+    // one after the other, not recursively.
+    static void releaseParent(std::shared_ptr<Context>& parent);
+    // takeParent moves out the reference this context holds to its parent.
+    virtual std::shared_ptr<Context> takeParent() { return nullptr; }
+
+    // Set by the constructors of the built-in contexts.
+    ContextKind _kind = ContextKind::other;
+    // _parentCtx is the context this one derives from, if any.
+    Context* _parentCtx = nullptr;
+    // _valueKey is the key of a value context.
+    const void* _valueKey = nullptr;
+    ContextArena* _arena = nullptr;
+
+private:
+    static constexpr int valueCacheSize = 2;
+
+    bool answers(const void* key) const;
+    std::atomic<Context*>& valueCache(const void* key) {
+        return _valueCache[(reinterpret_cast<std::uintptr_t>(key) >> 3) % valueCacheSize];
+    }
+
+    std::atomic<Context*> _valueCache[valueCacheSize] = {};
 };
 
 // An emptyCtx is never canceled, has no values, and has no deadline.
 // It is the common base of backgroundCtx and todoCtx.
 class EmptyCtx : public Context {
 public:
+    EmptyCtx() { _kind = ContextKind::empty; }
+
     virtual std::optional<std::chrono::time_point<std::chrono::system_clock>>
     deadline() const override {
         return {};
     }
+    virtual std::optional<std::chrono::steady_clock::time_point> steadyDeadline() const override {
+        return std::nullopt;
+    }
     virtual std::shared_ptr<UnbufferedChannel> done() override { return nullptr; }
     virtual Error err() override { return nullptr; }
     virtual std::optional<std::any> value(const void* key) override { return {}; }
@@ -165,6 +266,8 @@ public:
 // values, and has no deadline. It is typically used by the main function,
 // initialization, and tests, and as the top-level Context for incoming
 // requests.
+//
+// background and todo return the same process-wide context on every call.
 extern std::shared_ptr<Context> background();
 
 // TODO returns a non-nil, empty [Context]. Code should use context.TODO when
@@ -173,6 +276,19 @@ extern std::shared_ptr<Context> background();
 // parameter).
 extern std::shared_ptr<Context> todo();
 
+// makeContext allocates a built-in context of type T derived from parent:
+// from the arena of parent if it has one, with make_shared otherwise.
+template <typename T, typename... Args>
+std::shared_ptr<T> makeContext(Context* parent, Args&&... args) {
+    ContextArena* arena = parent ? parent->_arena : nullptr;
+    if (arena == nullptr) {
+        return std::make_shared<T>(std::forward<Args>(args)...);
+    }
+    auto c = std::allocate_shared<T>(ArenaAllocator<T>(arena), std::forward<Args>(args)...);
+    static_cast<Context*>(c.get())->_arena = arena;
+    return c;
+}
+
 // A CancelFunc tells an operation to abandon its work.
 // A CancelFunc does not wait for the work to stop.
 // A CancelFunc may be called by multiple goroutines simultaneously.
@@ -235,13 +351,21 @@ class CancelCtx : public Canceler, public std::enable_shared_from_this<CancelCtx
 public:
     static int cancelCtxKey;
 
-    CancelCtx() : _done(nullptr), _err(nullptr), _cause(nullptr) {}
+    CancelCtx() : _done(nullptr), _err(nullptr), _cause(nullptr) {
+        _kind = ContextKind::cancel;
+    }
 
+    // A cancelCtx has the deadline of its parent.
     virtual std::optional<std::chrono::time_point<std::chrono::system_clock>>
     deadline() const override {
-        return std::nullopt;
+        return _parent ? _parent->deadline() : std::nullopt;
+    }
+    virtual std::optional<std::chrono::steady_clock::time_point> steadyDeadline() const override {
+        return _parent ? _parent->steadyDeadline() : std::nullopt;
     }
     virtual std::shared_ptr<UnbufferedChannel> done() override;
+    // doneFd is an eventfd, created on first use like done.
+    virtual int doneFd() override;
     virtual Error err() override { std::lock_guard<std::mutex> lock(_mu); return _err; }
     virtual std::optional<std::any> value(const void* key) override;
 
@@ -251,24 +375,94 @@ public:
     virtual void cancel(bool removeFromParent, Error err, Error cause) override;
 
     // propagateCancel arranges for child to be canceled when parent is.
-    // It sets the parent context of cancelCtx.
+    // It sets the parent context of cancelCtx. child is c itself, or a
+    // Canceler wrapping it.
     void propagateCancel(std::shared_ptr<Context> parent, std::shared_ptr<Canceler> child);
 
     Error cause() const { std::lock_guard<std::mutex> lock(_mu); return _cause; }
-    std::unordered_set<std::shared_ptr<Canceler>>& children() {
-        std::lock_guard<std::mutex> lock(_mu); return _children;
-    }
     std::mutex& mu() const { return _mu; }
 
     std::shared_ptr<Context> parent() const { return _parent; }
 
+    virtual ~CancelCtx();
+
+protected:
+    virtual std::shared_ptr<Context> takeParent() override { return std::move(_parent); }
+
+    // canceled is called once, after c has been canceled and its children
+    // detached, with no lock held.
+    virtual void canceled() {}
+
 private:
+    // Children are the contexts to cancel along with a cancelCtx, kept in
+    // intrusive lists spread over shards by the child's address. Each shard
+    // has its own lock, so adding and removing a child is O(1) and children
+    // created concurrently rarely contend. Allocated with the first child.
+    struct Children;
+
+    Children* children();
+    // addChild links child into c's children. It returns false if c has
+    // already been canceled.
+    bool addChild(CancelCtx* child);
+    void removeChild(CancelCtx* child);
+    // markCanceled records err and closes done. If c was not canceled yet,
+    // it moves c's children to pending and returns true.
+    bool markCanceled(Error err, Error cause, std::vector<std::shared_ptr<CancelCtx>>& pending);
+
     std::shared_ptr<Context> _parent;
     mutable std::mutex _mu;
     std::atomic< std::shared_ptr< UnbufferedChannel > > _done;
-    std::unordered_set<std::shared_ptr<Canceler>> _children;
+    std::atomic<int> _doneFd{-1};
+    std::atomic<Children*> _children{nullptr};
     Error _err;
     Error _cause;
+
+    // _cancelParent is the cancelCtx c registered with, set once by
+    // propagateCancel. The links below are guarded by the lock of its
+    // shard; while linked, _self keeps c alive on behalf of the parent.
+    CancelCtx* _cancelParent = nullptr;
+    CancelCtx* _prevSibling = nullptr;
+    CancelCtx* _nextSibling = nullptr;
+    bool _linked = false;
+    std::shared_ptr<CancelCtx> _self;
+};
+
+// AfterFunc arranges to call f in its own goroutine after ctx is canceled.
+// If ctx is already canceled, AfterFunc calls f immediately in its own goroutine.
+//
+// Multiple calls to AfterFunc on a context operate independently;
+// one does not replace another.
+//
+// Calling the returned stop function stops the association of ctx with f.
+// It returns true if the call stopped f from being run.
+// If stop returns false,
+// either the context is canceled and f has been started in its own goroutine;
+// or f was already stopped.
+// The stop function does not wait for f to complete before returning.
+//
+// Here f is posted to runtime::defaultExecutor() rather than run in a
+// goroutine of its own. The registration is a child of the nearest cancelCtx
+// of ctx, so no thread watches ctx meanwhile, and stop unlinks it in O(1).
+// If ctx is cancelable some other way, a runtime::Task waits on its done
+// channel instead, until ctx is canceled.
+extern std::function<bool()> afterFunc(std::shared_ptr<Context> ctx, std::function<void()> f);
+
+// An afterFuncCtx is the registration made by AfterFunc: a cancelCtx whose
+// cancellation posts f, unless stop got there first.
+class AfterFuncCtx : public CancelCtx {
+public:
+    AfterFuncCtx(std::function<void()> f) : _f(std::move(f)) {}
+
+    // stop prevents f from running, if it has not been started yet.
+    bool stop();
+
+protected:
+    virtual void canceled() override;
+
+private:
+    // _once is set by whichever of cancel and stop comes first.
+    std::atomic<bool> _once{false};
+    std::function<void()> _f;
 };
 
 // WithoutCancel returns a copy of parent that is not canceled when parent is canceled.
@@ -279,12 +473,19 @@ extern std::shared_ptr<Context> withoutCancel(std::shared_ptr<Context> parent);
 class WithoutCancelCtx : public Context, public Stringer,
     public std::enable_shared_from_this<WithoutCancelCtx> {
 public:
-    WithoutCancelCtx(std::shared_ptr<Context> parent) : _parent(parent) {}
+    WithoutCancelCtx(std::shared_ptr<Context> parent) : _parent(parent) {
+        _kind = ContextKind::withoutCancel;
+        _parentCtx = _parent.get();
+    }
+    virtual ~WithoutCancelCtx() { releaseParent(_parent); }
 
     virtual std::optional<std::chrono::time_point<std::chrono::system_clock>>
     deadline() const override {
         return std::nullopt;
     }
+    virtual std::optional<std::chrono::steady_clock::time_point> steadyDeadline() const override {
+        return std::nullopt;
+    }
     virtual std::shared_ptr<UnbufferedChannel> done() { return nullptr; }
     virtual Error err() override { return nullptr; }
     virtual std::optional<std::any> value(const void* key) override;
@@ -294,10 +495,67 @@ public:
 
     std::shared_ptr<Context> parent() const { return _parent; }
 
+protected:
+    virtual std::shared_ptr<Context> takeParent() override { return std::move(_parent); }
+
 private:
     std::shared_ptr<Context> _parent;
 };
 
+// withArena returns a copy of parent allocated from a new ContextArena with
+// room for size bytes. The built-in contexts derived from it, their done
+// channels and children lists are allocated from the same arena, so a
+// request that builds its chain from here,
+//
+//	auto ctx = withArena(background());
+//	auto [c, cancel] = withTimeout(ctx, 100ms);
+//	auto v = withValue<RequestID>(c, id);
+//
+// makes a single allocation for all of it, provided it fits. The arena is
+// freed at once when the last context allocated from it is destroyed: once
+// the request is done, canceling its root releases the descendants, and
+// dropping the last reference to the root frees the whole chain.
+extern std::shared_ptr<Context> withArena(std::shared_ptr<Context> parent,
+    std::size_t size = ContextArena::defaultSize);
+
+// An arenaCtx is the root of the contexts allocated from an arena. It adds
+// nothing to its parent and delegates all calls to it.
+class ArenaCtx : public Context, public Stringer {
+public:
+    ArenaCtx(std::shared_ptr<Context> parent, ContextArena* arena) : _parent(std::move(parent)) {
+        _kind = ContextKind::arena;
+        _parentCtx = _parent.get();
+        _arena = arena;
+    }
+    virtual ~ArenaCtx() { releaseParent(_parent); }
+
+    virtual std::optional<std::chrono::system_clock::time_point>
+    deadline() const override {
+        return _parent->deadline();
+    }
+    virtual std::optional<std::chrono::steady_clock::time_point> steadyDeadline() const override {
+        return _parent->steadyDeadline();
+    }
+    virtual std::shared_ptr<UnbufferedChannel> done() override { return _parent->done(); }
+    virtual int doneFd() override { return _parent->doneFd(); }
+    virtual Error err() override { return _parent->err(); }
+    virtual std::optional<std::any> value(const void* key) override;
+    virtual const void* typedValue(const void* /*tag*/, Context** next) override {
+        *next = _parent.get();
+        return nullptr;
+    }
+    virtual std::string string() const override {
+        return contextName(_parent) + ".WithArena";
+    }
+
+    std::shared_ptr<Context> parent() const { return _parent; }
+
+protected:
+    virtual std::shared_ptr<Context> takeParent() override { return std::move(_parent); }
+
+private:
+    std::shared_ptr<Context> _parent;
+};
 
 // WithDeadlineCause behaves like [WithDeadline] but also sets the cause of the
 // returned Context when the deadline is exceeded. The returned [CancelFunc] does
@@ -317,41 +575,81 @@ extern std::pair<std::shared_ptr<Context>, CancelFunc> withDeadlineCause(std::sh
 extern std::pair<std::shared_ptr<Context>, CancelFunc> withDeadline(std::shared_ptr<Context> parent,
     std::chrono::time_point<std::chrono::system_clock> d);
 
+// withDeadline and withDeadlineCause with a steady deadline are unaffected by
+// wall-clock jumps, and need no clock read to set up.
+extern std::pair<std::shared_ptr<Context>, CancelFunc> withDeadline(std::shared_ptr<Context> parent,
+    std::chrono::steady_clock::time_point d);
+extern std::pair<std::shared_ptr<Context>, CancelFunc> withDeadlineCause(std::shared_ptr<Context> parent,
+    std::chrono::steady_clock::time_point d, Error cause);
+
 // A timerCtx carries a timer and a deadline. It embeds a cancelCtx to
-// implement Done and Err. It implements cancel by stopping its timer then
-// delegating to cancelCtx.cancel.
+// implement Done and Err, and stops its timer once canceled.
 class TimerCtx : public CancelCtx, public Stringer {
 public:
-    TimerCtx(std::chrono::time_point<std::chrono::system_clock> deadline) : _deadline(deadline) {}
+    // TimerCtx keeps its deadline on the steady clock. The wall-clock
+    // deadline is derived on first use, unless it is given.
+    TimerCtx(std::chrono::steady_clock::time_point deadline,
+             std::optional<std::chrono::system_clock::time_point> wallDeadline = std::nullopt)
+        : _deadline(deadline) {
+        if (wallDeadline) {
+            _wallDeadline.store(wallDeadline->time_since_epoch().count(), std::memory_order_relaxed);
+        }
+    }
 
     virtual std::optional<std::chrono::time_point<std::chrono::system_clock>>
     deadline() const override {
+        return wallDeadline();
+    }
+    virtual std::optional<std::chrono::steady_clock::time_point> steadyDeadline() const override {
         return _deadline;
     }
 
     virtual std::string string() const override {
+        auto d = wallDeadline();
         return contextName(parent()) + ".WithDeadline(" +
-            deadlineString(_deadline) + " [" + timeUntilString(_deadline) + "])";
+            deadlineString(d) + " [" + timeUntilString(d) + "])";
     }
 
-    virtual void cancel(bool removeFromParent, Error err, Error cause) override {
-        CancelCtx::cancel(false, err, cause);
-        if (removeFromParent) {
-            // Remove this timerCtx from its parent cancelCtx's children.
-            // removeChild(parent(), this);
-        }
-        mu().lock();
-        if (_timer.isRunning()) {
-            _timer.stop();
+    time::Timer& timer() { return _timer; }
+
+    // arm starts the timer, which cancels c with cause at the deadline.
+    void arm(Error cause);
+
+protected:
+    // canceled stops the timer, unlinking it from the shared wheel right
+    // away. This never waits for the callback, which may be the caller.
+    virtual void canceled() override;
+
+private:
+    // wallDeadline converts the deadline once; successive calls return the
+    // same result.
+    std::chrono::system_clock::time_point wallDeadline() const {
+        using system_clock = std::chrono::system_clock;
+        auto rep = _wallDeadline.load(std::memory_order_relaxed);
+        if (rep == unset) {
+            auto d = system_clock::now() + std::chrono::duration_cast<system_clock::duration>(
+                _deadline - std::chrono::steady_clock::now());
+            auto expected = unset;
+            if (!_wallDeadline.compare_exchange_strong(expected, d.time_since_epoch().count(),
+                                                       std::memory_order_relaxed)) {
+                rep = expected;
+            } else {
+                rep = d.time_since_epoch().count();
+            }
         }
-        mu().unlock();
+        return system_clock::time_point(system_clock::duration(rep));
     }
 
-    time::Timer& timer() { return _timer; }
+    static constexpr std::chrono::system_clock::rep unset = std::numeric_limits<std::chrono::system_clock::rep>::min();
 
-private:
-    std::chrono::time_point<std::chrono::system_clock> _deadline;
+    std::chrono::steady_clock::time_point _deadline;
+    mutable std::atomic<std::chrono::system_clock::rep> _wallDeadline{unset};
     time::Timer _timer;
+    // While the timer is pending, _armed keeps c alive on its behalf. The
+    // callback only captures this, so that it fits std::function without
+    // an allocation of its own.
+    std::shared_ptr<TimerCtx> _armed;
+    Error _deadlineCause;
 };
 
 // WithTimeout returns WithDeadline(parent, time.Now().Add(timeout)).
@@ -386,7 +684,11 @@ public:
                 assert(_key != nullptr);
                 std::memcpy(_key, k, k_size);
             }
+            _kind = ContextKind::value;
+            _parentCtx = _parent.get();
+            _valueKey = _key;
         }
+    virtual ~ValueCtx() { releaseParent(_parent); }
 
     void* key() { return _key; }
     std::any value() { return _value; }
@@ -405,6 +707,9 @@ public:
 
     auto parent() const { return _parent; }
 
+protected:
+    virtual std::shared_ptr<Context> takeParent() override { return std::move(_parent); }
+
 private:
     std::shared_ptr<Context> _parent;
     void* _key;
@@ -433,7 +738,7 @@ std::string stringify(const T& v) {
 }
 
 template <>
-std::string stringify<std::shared_ptr<Stringer>>(const std::shared_ptr<Stringer>& v) {
+inline std::string stringify<std::shared_ptr<Stringer>>(const std::shared_ptr<Stringer>& v) {
     return v->string();
 }
 
@@ -441,17 +746,17 @@ std::string stringify<std::shared_ptr<Stringer>>(const std::shared_ptr<Stringer>
 /// @param v 
 /// @return 
 template <>
-std::string stringify<Stringer>(const Stringer& v) {
+inline std::string stringify<Stringer>(const Stringer& v) {
     return v.string();
 }
 
 template <>
-std::string stringify<std::string>(const std::string& v) {
+inline std::string stringify<std::string>(const std::string& v) {
     return v;
 }
 
 template <>
-std::string stringify<std::nullptr_t>(const std::nullptr_t& v) {
+inline std::string stringify<std::nullptr_t>(const std::nullptr_t& v) {
     return "<nil>";
 }
 
@@ -468,7 +773,112 @@ withValue(std::shared_ptr<Context> parent, const T& key, const V& val)
     if (!goincpp::reflect::is_comparable<T>::value) {
         throw std::invalid_argument("key is not comparable");
     }
-    return std::make_shared<ValueCtx>(parent, key, val);
+    return makeContext<ValueCtx>(parent.get(), parent, key, val);
+}
+
+// value resolves key from c for the untyped Context::value, walking the
+// chain with Context::lookup.
+extern std::optional<std::any> value(std::shared_ptr<Context> c, const void* key);
+
+// ValueKey gives each key type of the typed withValue<Key> its identity:
+// the address of ValueKey<Key>::tag, unique per type within the program.
+template <typename Key>
+struct ValueKey {
+    static constexpr char tag = 0;
+};
+
+// A TypedValueCtx carries one value of type Key::type for the key type Key.
+// The value is stored inline, so the context and its value take a single
+// allocation, and everything but the value is delegated to the parent.
+template <typename Key>
+class TypedValueCtx : public Context, public Stringer {
+public:
+    using Value = typename Key::type;
+
+    TypedValueCtx(std::shared_ptr<Context> parent, Value v)
+        : _parent(std::move(parent)), _value(std::move(v)) {
+        _kind = ContextKind::typedValue;
+        _parentCtx = _parent.get();
+        _valueKey = &ValueKey<Key>::tag;
+    }
+    virtual ~TypedValueCtx() { releaseParent(_parent); }
+
+    virtual std::optional<std::chrono::system_clock::time_point>
+    deadline() const override {
+        return _parent->deadline();
+    }
+    virtual std::optional<std::chrono::steady_clock::time_point> steadyDeadline() const override {
+        return _parent->steadyDeadline();
+    }
+    virtual std::shared_ptr<UnbufferedChannel> done() override { return _parent->done(); }
+    virtual int doneFd() override { return _parent->doneFd(); }
+    virtual Error err() override { return _parent->err(); }
+
+    // value serves the untyped lookup with a copy of the value, keyed by
+    // &ValueKey<Key>::tag.
+    virtual std::optional<std::any> value(const void* key) override {
+        if (key == &ValueKey<Key>::tag) {
+            return std::any(_value);
+        }
+        return context::value(_parent, key);
+    }
+
+    virtual const void* typedValue(const void* tag, Context** next) override {
+        if (tag == &ValueKey<Key>::tag) {
+            return &_value;
+        }
+        *next = _parent.get();
+        return nullptr;
+    }
+
+    std::string string() const override {
+        return contextName(_parent) + ".WithValue(" +
+            typeid(Key).name() + ", " + stringify(_value) + ")";
+    }
+
+    std::shared_ptr<Context> parent() const { return _parent; }
+
+protected:
+    virtual std::shared_ptr<Context> takeParent() override { return std::move(_parent); }
+
+private:
+    std::shared_ptr<Context> _parent;
+    Value _value;
+};
+
+// lookupValue walks from c towards the root for the value stored under tag
+// by withValue<Key>. It returns nullptr if there is none.
+extern const void* lookupValue(Context* c, const void* tag);
+
+// withValue<Key> returns a copy of parent in which the value associated with
+// the key type Key is v. Key is typically an empty struct declaring the type
+// of its values:
+//
+//	struct RequestID { using type = std::string; };
+//	auto ctx = withValue<RequestID>(parent, "1234");
+//	const std::string* id = valueOf<RequestID>(ctx);
+//
+// Keys are told apart by type at compile time, so distinct packages cannot
+// collide as long as each uses its own key types.
+template <typename Key>
+std::shared_ptr<Context>
+withValue(std::shared_ptr<Context> parent, typename Key::type v)
+{
+    if (!parent) {
+        throw std::invalid_argument("cannot create context from nil parent");
+    }
+    Context* p = parent.get();
+    return makeContext<TypedValueCtx<Key>>(p, std::move(parent), std::move(v));
+}
+
+// valueOf<Key> returns the value associated with Key in ctx, or nullptr. The
+// lookup compares one tag per ancestor and never allocates. The value lives
+// as long as the context that stores it.
+template <typename Key>
+const typename Key::type*
+valueOf(const std::shared_ptr<Context>& ctx)
+{
+    return static_cast<const typename Key::type*>(lookupValue(ctx.get(), &ValueKey<Key>::tag));
 }
 
 }
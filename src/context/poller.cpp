@@ -0,0 +1,126 @@
+// Copyright 2024 The Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "poller.hpp"
+
+#if defined(__linux__)
+
+#include <algorithm>
+#include <cerrno>
+#include <stdexcept>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+namespace goincpp {
+namespace context {
+
+bool
+watchDone(int epfd, const std::shared_ptr<Context>& ctx, uint64_t data) {
+    int fd = ctx->doneFd();
+    if (fd < 0) {
+        return false;
+    }
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.u64 = data;
+    return epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == 0;
+}
+
+DonePoller::DonePoller() : _epfd(epoll_create1(EPOLL_CLOEXEC)) {
+    if (_epfd < 0) {
+        throw std::runtime_error("context: epoll_create1 failed");
+    }
+}
+
+DonePoller::~DonePoller() {
+    close(_epfd);
+}
+
+bool
+DonePoller::add(std::shared_ptr<Context> ctx) {
+    int fd = ctx->doneFd();
+    if (fd < 0) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(_mu);
+    auto t = _tokens.find(fd);
+    if (t == _tokens.end()) {
+        uint64_t token = _nextToken++;
+        if (!watchDone(_epfd, ctx, token)) {
+            return false;
+        }
+        t = _tokens.emplace(fd, token).first;
+        _watched.emplace(token, Watch{fd, {}});
+    }
+    _watched[t->second].ctxs.push_back(std::move(ctx));
+    _size++;
+    return true;
+}
+
+void
+DonePoller::remove(const std::shared_ptr<Context>& ctx) {
+    int fd = ctx->doneFd();
+    if (fd < 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(_mu);
+    auto t = _tokens.find(fd);
+    if (t == _tokens.end()) {
+        return;
+    }
+    auto it = _watched.find(t->second);
+    auto& ctxs = it->second.ctxs;
+    auto c = std::find(ctxs.begin(), ctxs.end(), ctx);
+    if (c == ctxs.end()) {
+        return;
+    }
+    ctxs.erase(c);
+    _size--;
+    if (ctxs.empty()) {
+        // Unregistered before the last context, and with it the
+        // descriptor, can go away.
+        epoll_ctl(_epfd, EPOLL_CTL_DEL, fd, nullptr);
+        _watched.erase(it);
+        _tokens.erase(t);
+    }
+}
+
+std::vector<std::shared_ptr<Context>>
+DonePoller::wait(std::chrono::milliseconds timeout) {
+    constexpr int maxEvents = 64;
+    struct epoll_event events[maxEvents];
+    int n;
+    do {
+        n = epoll_wait(_epfd, events, maxEvents, timeout.count() < 0 ? -1 : static_cast<int>(timeout.count()));
+    } while (n < 0 && errno == EINTR);
+
+    std::vector<std::shared_ptr<Context>> done;
+    std::lock_guard<std::mutex> lock(_mu);
+    for (int i = 0; i < n; i++) {
+        auto it = _watched.find(events[i].data.u64);
+        if (it == _watched.end()) {
+            continue; // removed meanwhile
+        }
+        int fd = it->second.fd;
+        epoll_ctl(_epfd, EPOLL_CTL_DEL, fd, nullptr);
+        _size -= it->second.ctxs.size();
+        for (auto& ctx : it->second.ctxs) {
+            done.push_back(std::move(ctx));
+        }
+        _watched.erase(it);
+        _tokens.erase(fd);
+    }
+    return done;
+}
+
+std::size_t
+DonePoller::size() const {
+    std::lock_guard<std::mutex> lock(_mu);
+    return _size;
+}
+
+}
+}
+
+#endif // __linux__
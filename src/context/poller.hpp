@@ -0,0 +1,87 @@
+// Copyright 2024 The Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef GOINCPP_CONTEXT_POLLER_HPP
+#define GOINCPP_CONTEXT_POLLER_HPP
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "context.hpp"
+
+namespace goincpp {
+namespace context {
+
+#if defined(__linux__)
+
+// watchDone adds the doneFd of ctx to the epoll set epfd, level-triggered,
+// with data as the event's user data. It returns false if ctx can never be
+// canceled, or the descriptor could not be added. Descriptors are shared
+// between a context and the value contexts derived from it, so a set may
+// only hold one of them.
+extern bool watchDone(int epfd, const std::shared_ptr<Context>& ctx, uint64_t data);
+
+// A DonePoller waits for the cancellation of many contexts at once on a
+// single epoll set, without a thread per context. Its own descriptor can in
+// turn be added to an event loop's epoll set, which then wakes up when any
+// watched context is canceled.
+//
+// A DonePoller may be used by multiple threads simultaneously.
+class DonePoller {
+public:
+    DonePoller();
+    ~DonePoller();
+
+    DonePoller(const DonePoller&) = delete;
+    DonePoller& operator=(const DonePoller&) = delete;
+
+    // fd returns the epoll descriptor, readable while a watched context is
+    // canceled.
+    int fd() const { return _epfd; }
+
+    // add watches ctx. It returns false if ctx can never be canceled.
+    bool add(std::shared_ptr<Context> ctx);
+
+    // remove stops watching ctx.
+    void remove(const std::shared_ptr<Context>& ctx);
+
+    // wait returns the watched contexts that are canceled, waiting for at
+    // most timeout for one to be, or forever if timeout is negative. The
+    // contexts returned are no longer watched.
+    std::vector<std::shared_ptr<Context>> wait(std::chrono::milliseconds timeout = std::chrono::milliseconds(-1));
+
+    // size returns the number of watched contexts.
+    std::size_t size() const;
+
+private:
+    // A Watch is the registration of one doneFd, shared by the contexts
+    // that have it.
+    struct Watch {
+        int fd;
+        std::vector<std::shared_ptr<Context>> ctxs;
+    };
+
+    int _epfd;
+    mutable std::mutex _mu;
+    // _watched maps the token of each registration, which its epoll events
+    // carry, to the registration. A descriptor number may be closed and
+    // reused once its contexts are no longer watched; an event for the old
+    // registration still pending in wait then finds no token, rather than
+    // the new context with the same descriptor.
+    std::unordered_map<uint64_t, Watch> _watched;
+    // _tokens maps each watched doneFd to the token of its registration.
+    std::unordered_map<int, uint64_t> _tokens;
+    uint64_t _nextToken = 0;
+    std::size_t _size = 0;
+};
+
+#endif // __linux__
+
+}
+}
+
+#endif // GOINCPP_CONTEXT_POLLER_HPP
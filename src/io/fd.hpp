@@ -0,0 +1,143 @@
+// Copyright 2024 The Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef GOINCPP_IO_FD_HPP
+#define GOINCPP_IO_FD_HPP
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstddef>
+#include <cstring>
+#include <span>
+#include <string>
+#include <string_view>
+
+#include <poll.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "../errors/errors.hpp"
+#include "writer.hpp"
+
+namespace goincpp {
+namespace io {
+
+// SyscallError records an error from a system call and its errno.
+class SyscallError : public errors::ErrorString {
+public:
+    SyscallError(const std::string& syscall, int errnum)
+        : ErrorString(syscall + ": " + std::strerror(errnum)), _errnum(errnum) {}
+
+    int errnum() const { return _errnum; }
+
+private:
+    int _errnum;
+};
+
+// FdWriter writes to a POSIX file descriptor with plain write and writev
+// calls, bypassing iostreams. Short writes are continued until everything
+// is written or an error occurs; interrupted calls are retried, and a
+// non-blocking descriptor that is full is waited on with poll.
+//
+// The descriptor is not owned: FdWriter never closes it. An FdWriter may be
+// used by multiple threads simultaneously, but their writes may interleave.
+class FdWriter {
+public:
+    explicit FdWriter(int fd) : _fd(fd) {}
+
+    int Fd() const { return _fd; }
+
+    // Write writes the n bytes at p. The number of bytes written is stored
+    // in *nn if given; it is less than n only if an error is returned.
+    Error Write(const void* p, std::size_t n, std::size_t* nn = nullptr) {
+        iovec iov{const_cast<void*>(p), n};
+        return WriteV(std::span<iovec>(&iov, 1), nn);
+    }
+
+    Error WriteString(std::string_view s, std::size_t* nn = nullptr) {
+        return Write(s.data(), s.size(), nn);
+    }
+
+    // WriteV writes the buffers of iov in order, as many per writev call as
+    // the system allows, so that headers and payloads go out together
+    // without being copied into one buffer first. The entries are consumed
+    // as they are written: on return, iov describes the bytes that were not
+    // written, all of them empty on success. The number of bytes written is
+    // stored in *nn if given.
+    Error WriteV(std::span<iovec> iov, std::size_t* nn = nullptr) {
+        std::size_t total = 0;
+        Error err;
+        std::size_t i = 0;
+        while (i < iov.size()) {
+            if (iov[i].iov_len == 0) {
+                i++;
+                continue;
+            }
+            int count = static_cast<int>(std::min<std::size_t>(iov.size() - i, IOV_MAX));
+            ssize_t n = ::writev(_fd, &iov[i], count);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    err = waitWritable();
+                    if (err == nullptr) {
+                        continue;
+                    }
+                    break;
+                }
+                err = std::make_shared<SyscallError>("writev", errno);
+                break;
+            }
+            if (n == 0) {
+                err = errShortWrite;
+                break;
+            }
+            total += static_cast<std::size_t>(n);
+            i = consume(iov, i, static_cast<std::size_t>(n));
+        }
+        if (nn) {
+            *nn = total;
+        }
+        return err;
+    }
+
+private:
+    // consume marks n bytes written, starting at entry i, and returns the
+    // first entry left with bytes to write.
+    static std::size_t consume(std::span<iovec> iov, std::size_t i, std::size_t n) {
+        while (n > 0) {
+            if (n >= iov[i].iov_len) {
+                n -= iov[i].iov_len;
+                iov[i].iov_len = 0;
+                i++;
+            } else {
+                iov[i].iov_base = static_cast<char*>(iov[i].iov_base) + n;
+                iov[i].iov_len -= n;
+                n = 0;
+            }
+        }
+        return i;
+    }
+
+    Error waitWritable() {
+        pollfd pfd{_fd, POLLOUT, 0};
+        for (;;) {
+            if (::poll(&pfd, 1, -1) >= 0) {
+                return nullptr;
+            }
+            if (errno != EINTR) {
+                return std::make_shared<SyscallError>("poll", errno);
+            }
+        }
+    }
+
+    int _fd;
+};
+
+}
+}
+
+#endif // GOINCPP_IO_FD_HPP
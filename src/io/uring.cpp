@@ -0,0 +1,535 @@
+// Copyright 2024 The Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "uring.hpp"
+
+#if defined(__linux__)
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "fd.hpp"
+#include "../runtime/select.hpp"
+
+namespace goincpp {
+namespace io {
+
+// stopTag is the user data of the no-op that tells the reaper to exit.
+static constexpr uint64_t stopTag = ~uint64_t(0);
+
+// Ring is an io_uring set up and mapped with raw system calls, as liburing
+// would, without depending on it. Only the writer's mutex holder adds
+// entries; only the reaper consumes completions.
+struct UringWriter::Ring {
+    int fd = -1;
+    unsigned features = 0;
+
+    void* sq = MAP_FAILED;
+    std::size_t sqSize = 0;
+    void* cq = MAP_FAILED;
+    std::size_t cqSize = 0;
+    io_uring_sqe* sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+    std::size_t sqesSize = 0;
+
+    unsigned* sqHead = nullptr;
+    unsigned* sqTail = nullptr;
+    unsigned sqMask = 0;
+    unsigned* sqArray = nullptr;
+    unsigned* cqHead = nullptr;
+    unsigned* cqTail = nullptr;
+    unsigned cqMask = 0;
+    io_uring_cqe* cqes = nullptr;
+
+    // open returns nullptr if io_uring cannot be used.
+    static std::unique_ptr<Ring> open(unsigned entries) {
+        io_uring_params p;
+        std::memset(&p, 0, sizeof(p));
+        int fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &p));
+        if (fd < 0) {
+            return nullptr;
+        }
+        auto r = std::make_unique<Ring>();
+        r->fd = fd;
+        r->features = p.features;
+
+        r->sqSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        r->cqSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single) {
+            r->sqSize = r->cqSize = std::max(r->sqSize, r->cqSize);
+        }
+        r->sq = mmap(nullptr, r->sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     fd, IORING_OFF_SQ_RING);
+        if (r->sq == MAP_FAILED) {
+            return nullptr;
+        }
+        if (single) {
+            r->cq = r->sq;
+        } else {
+            r->cq = mmap(nullptr, r->cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         fd, IORING_OFF_CQ_RING);
+            if (r->cq == MAP_FAILED) {
+                return nullptr;
+            }
+        }
+        r->sqesSize = p.sq_entries * sizeof(io_uring_sqe);
+        r->sqes = static_cast<io_uring_sqe*>(mmap(nullptr, r->sqesSize, PROT_READ | PROT_WRITE,
+                                                  MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+        if (r->sqes == MAP_FAILED) {
+            return nullptr;
+        }
+
+        auto sq = static_cast<char*>(r->sq);
+        r->sqHead = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+        r->sqTail = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+        r->sqMask = *reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+        r->sqArray = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+        auto cq = static_cast<char*>(r->cq);
+        r->cqHead = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+        r->cqTail = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+        r->cqMask = *reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+        r->cqes = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+        return r;
+    }
+
+    ~Ring() {
+        close();
+    }
+
+    // close unmaps the ring and closes its descriptor, which cancels the
+    // requests still in flight. The ring cannot be used afterwards.
+    void close() {
+        if (sqes != MAP_FAILED) {
+            munmap(sqes, sqesSize);
+            sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+        }
+        if (cq != MAP_FAILED && cq != sq) {
+            munmap(cq, cqSize);
+        }
+        cq = MAP_FAILED;
+        if (sq != MAP_FAILED) {
+            munmap(sq, sqSize);
+            sq = MAP_FAILED;
+        }
+        if (fd >= 0) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+
+    // push adds an entry to the submission ring. The ring is sized so that
+    // it cannot be full: it has room for every slot and the stop no-op.
+    void push(const io_uring_sqe& sqe) {
+        unsigned tail = *sqTail;
+        unsigned index = tail & sqMask;
+        sqes[index] = sqe;
+        sqArray[index] = index;
+        std::atomic_ref<unsigned>(*sqTail).store(tail + 1, std::memory_order_release);
+    }
+
+    int enter(unsigned toSubmit, unsigned minComplete, unsigned flags) {
+        return static_cast<int>(syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0));
+    }
+};
+
+UringWriter::UringWriter(int fd, UringWriterOptions options)
+    : _fd(fd), _options(std::move(options)) {
+    unsigned slots = std::max(1u, _options.maxInFlight);
+    _slots.resize(slots);
+    for (unsigned i = slots; i > 0; i--) {
+        _free.push_back(i - 1);
+    }
+    off_t pos = lseek(fd, 0, SEEK_CUR);
+    if (pos < 0) {
+        _seekable = false;
+    } else {
+        _append = static_cast<uint64_t>(pos);
+    }
+    if (!_options.onComplete) {
+        _completions = CompletionChannel::make();
+    }
+    _stop = runtime::UnbufferedChannel::make();
+
+    if (_options.uring) {
+        unsigned entries = 1;
+        while (entries < slots + 1) {
+            entries <<= 1;
+        }
+        _ring = Ring::open(entries);
+        // IORING_OP_WRITE, and writing at the current position, came with
+        // IORING_FEAT_RW_CUR_POS.
+        if (_ring && !(_ring->features & IORING_FEAT_RW_CUR_POS)) {
+            _ring.reset();
+        }
+    }
+    if (_ring) {
+        _reaper = std::thread([this]() { reap(); });
+    } else {
+        _pool = std::make_unique<runtime::ThreadPool>(std::max(1u, _options.fallbackThreads));
+    }
+    _deliverer = std::thread([this]() { deliver(); });
+}
+
+UringWriter::~UringWriter() {
+    Flush();
+    if (_ring) {
+        do {
+            std::lock_guard<std::mutex> lock(_mu);
+            if (_err) {
+                // The reaper is gone already.
+                break;
+            }
+            io_uring_sqe sqe;
+            std::memset(&sqe, 0, sizeof(sqe));
+            sqe.opcode = IORING_OP_NOP;
+            sqe.user_data = stopTag;
+            _ring->push(sqe);
+            _unsubmitted++;
+            // Counted like a write, so that Flush submits it and waits for
+            // the reaper to take it.
+            _pending++;
+            _stopping = true;
+        } while(0);
+        Flush();
+        _reaper.join();
+    }
+    // The pool runs what is left and joins its threads.
+    _pool.reset();
+
+    _stop->close();
+    do {
+        std::lock_guard<std::mutex> lock(_mu);
+        _doneReady.notify_all();
+    } while(0);
+    _deliverer.join();
+    if (_completions) {
+        _completions->close();
+    }
+}
+
+uint64_t
+UringWriter::Write(Buffer buf) {
+    return queue(std::move(buf), 0, false);
+}
+
+uint64_t
+UringWriter::WriteAt(Buffer buf, uint64_t offset) {
+    return queue(std::move(buf), offset, true);
+}
+
+uint64_t
+UringWriter::queue(Buffer buf, uint64_t offset, bool at) {
+    std::unique_lock<std::mutex> lock(_mu);
+    if (_free.empty()) {
+        // Whatever is queued must get going before we can wait for it.
+        submitLocked();
+        waitLocked(lock, _slotFree, [this]() { return !_free.empty(); });
+    }
+    unsigned slot = _free.back();
+    _free.pop_back();
+    Request& r = _slots[slot];
+    r.positional = at || _seekable;
+    if (at) {
+        r.offset = offset;
+    } else if (_seekable) {
+        r.offset = _append;
+        _append += buf.size();
+    }
+    r.buf = std::move(buf);
+    r.id = _nextId++;
+    r.done = 0;
+    _pending++;
+    if (_err) {
+        uint64_t id = r.id;
+        Error err = _err;
+        lock.unlock();
+        complete(slot, err);
+        return id;
+    }
+    _queued.push_back(slot);
+    if (_queued.size() >= std::max(1u, _options.batch)) {
+        submitLocked();
+    }
+    return r.id;
+}
+
+void
+UringWriter::Submit() {
+    std::lock_guard<std::mutex> lock(_mu);
+    submitLocked();
+}
+
+void
+UringWriter::Flush() {
+    std::unique_lock<std::mutex> lock(_mu);
+    submitLocked();
+    waitLocked(lock, _idle, [this]() { return _pending == 0; });
+}
+
+void
+UringWriter::waitLocked(std::unique_lock<std::mutex>& lock, std::condition_variable& cond,
+                        const std::function<bool()>& done) {
+    constexpr auto maxBackoff = std::chrono::milliseconds(100);
+    auto backoff = std::chrono::milliseconds(1);
+    while (!done()) {
+        if (_unsubmitted == 0) {
+            // submitLocked wakes us up if it leaves entries behind.
+            cond.wait(lock);
+            continue;
+        }
+        // The kernel turned entries away. With nothing else in flight, no
+        // completion would come along to submit them, so retry here.
+        cond.wait_for(lock, backoff);
+        backoff = std::min(backoff * 2, maxBackoff);
+        submitLocked();
+    }
+}
+
+std::size_t
+UringWriter::InFlight() const {
+    std::lock_guard<std::mutex> lock(_mu);
+    return _slots.size() - _free.size();
+}
+
+void
+UringWriter::submitLocked() {
+    if (_err) {
+        // The reaper is gone; fail reported everything.
+        return;
+    }
+    if (!_ring) {
+        for (unsigned slot : _queued) {
+            _pool->post([this, slot]() { writeFallback(slot); });
+        }
+        _queued.clear();
+        return;
+    }
+    for (unsigned slot : _queued) {
+        prepare(slot);
+    }
+    _queued.clear();
+    // One system call for the whole batch.
+    while (_unsubmitted > 0) {
+        int n = _ring->enter(_unsubmitted, 0, 0);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // EAGAIN or EBUSY: the kernel is short of resources. The
+            // entries stay in the ring and go with the next submission, or
+            // with the retries of whoever waits for them.
+            _idle.notify_all();
+            _slotFree.notify_all();
+            break;
+        }
+        _unsubmitted -= static_cast<unsigned>(n);
+    }
+}
+
+void
+UringWriter::prepare(unsigned slot) {
+    Request& r = _slots[slot];
+    io_uring_sqe sqe;
+    std::memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_WRITE;
+    sqe.fd = _fd;
+    sqe.addr = reinterpret_cast<uint64_t>(r.buf.data() + r.done);
+    sqe.len = static_cast<uint32_t>(std::min<std::size_t>(r.buf.size() - r.done, UINT32_MAX));
+    sqe.off = r.positional ? r.offset + r.done : ~uint64_t(0);
+    sqe.user_data = slot;
+    _ring->push(sqe);
+    _unsubmitted++;
+}
+
+void
+UringWriter::reap() {
+    for (;;) {
+        if (_ring->enter(0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR &&
+            errno != EAGAIN && errno != EBUSY) {
+            fail(std::make_shared<SyscallError>("io_uring_enter", errno));
+            return;
+        }
+        unsigned head = *_ring->cqHead;
+        unsigned tail = std::atomic_ref<unsigned>(*_ring->cqTail).load(std::memory_order_acquire);
+        bool stop = false;
+        for (; head != tail; head++) {
+            const io_uring_cqe& cqe = _ring->cqes[head & _ring->cqMask];
+            uint64_t tag = cqe.user_data;
+            int res = cqe.res;
+            // Free the entry before reporting, which may block.
+            std::atomic_ref<unsigned>(*_ring->cqHead).store(head + 1, std::memory_order_release);
+            if (tag == stopTag) {
+                stop = true;
+                std::lock_guard<std::mutex> lock(_mu);
+                if (--_pending == 0) {
+                    _idle.notify_all();
+                }
+                continue;
+            }
+            auto slot = static_cast<unsigned>(tag);
+            if (res == -EINTR || res == -EAGAIN) {
+                std::lock_guard<std::mutex> lock(_mu);
+                prepare(slot);
+                submitLocked();
+                continue;
+            }
+            if (res < 0) {
+                complete(slot, std::make_shared<SyscallError>("io_uring write", -res));
+                continue;
+            }
+            bool left;
+            do {
+                std::lock_guard<std::mutex> lock(_mu);
+                Request& r = _slots[slot];
+                r.done += static_cast<std::size_t>(res);
+                left = r.done < r.buf.size();
+                if (left && res > 0) {
+                    // Short write: continue with the rest.
+                    prepare(slot);
+                    submitLocked();
+                }
+            } while(0);
+            if (left && res > 0) {
+                continue;
+            }
+            complete(slot, left ? errShortWrite : nullptr);
+        }
+        if (stop) {
+            return;
+        }
+    }
+}
+
+void
+UringWriter::fail(Error err) {
+    std::vector<unsigned> outstanding;
+    do {
+        std::lock_guard<std::mutex> lock(_mu);
+        _err = err;
+        // The ring is abandoned with whatever is left in it, the stop
+        // no-op included. Closing it makes the kernel cancel the writes it
+        // still has, so that their buffers can be handed back; the writes
+        // it never saw are failed as they are.
+        _ring->close();
+        _queued.clear();
+        _unsubmitted = 0;
+        std::vector<bool> free(_slots.size());
+        for (unsigned slot : _free) {
+            free[slot] = true;
+        }
+        for (unsigned slot = 0; slot < _slots.size(); slot++) {
+            if (!free[slot]) {
+                outstanding.push_back(slot);
+            }
+        }
+        if (_stopping && --_pending == 0) {
+            _idle.notify_all();
+        }
+    } while(0);
+    for (unsigned slot : outstanding) {
+        complete(slot, err);
+    }
+}
+
+void
+UringWriter::writeFallback(unsigned slot) {
+    Request& r = _slots[slot];
+    Error err;
+    while (r.done < r.buf.size()) {
+        const char* p = r.buf.data() + r.done;
+        std::size_t n = r.buf.size() - r.done;
+        ssize_t m = r.positional ? pwrite(_fd, p, n, static_cast<off_t>(r.offset + r.done))
+                                 : write(_fd, p, n);
+        if (m < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                pollfd pfd{_fd, POLLOUT, 0};
+                poll(&pfd, 1, -1);
+                continue;
+            }
+            err = std::make_shared<SyscallError>(r.positional ? "pwrite" : "write", errno);
+            break;
+        }
+        if (m == 0) {
+            err = errShortWrite;
+            break;
+        }
+        r.done += static_cast<std::size_t>(m);
+    }
+    complete(slot, err);
+}
+
+void
+UringWriter::complete(unsigned slot, Error err) {
+    do {
+        std::lock_guard<std::mutex> lock(_mu);
+        Request& r = _slots[slot];
+        WriteCompletion c;
+        c.id = r.id;
+        c.n = r.done;
+        c.err = std::move(err);
+        c.buf = std::move(r.buf);
+        r = Request();
+        _free.push_back(slot);
+        _done.push_back(std::move(c));
+        // Completions sent on the channel are not waited for; the ones
+        // passed to onComplete are, once deliver is done with them.
+        if (!_options.onComplete && --_pending == 0) {
+            _idle.notify_all();
+        }
+    } while(0);
+    _slotFree.notify_one();
+    _doneReady.notify_one();
+}
+
+void
+UringWriter::deliver() {
+    std::unique_lock<std::mutex> lock(_mu);
+    for (;;) {
+        _doneReady.wait(lock, [this]() { return !_done.empty() || _stop->closed(); });
+        if (_done.empty()) {
+            return;
+        }
+        WriteCompletion c = std::move(_done.front());
+        _done.pop_front();
+        lock.unlock();
+
+        if (_options.onComplete) {
+            _options.onComplete(std::move(c));
+            lock.lock();
+            if (--_pending == 0) {
+                _idle.notify_all();
+            }
+            continue;
+        }
+        // Until the writer goes away, wait for the receiver to make room.
+        // Then c is only moved from if the send case fired.
+        bool sent = !_stop->closed() &&
+                    runtime::select(runtime::caseSend(_completions, std::move(c)),
+                                    runtime::caseRecv(_stop)) == 0;
+        if (!sent && _completions->trySend(std::move(c)) != runtime::ChanStatus::ok) {
+            // Nobody makes room any more: drop the rest.
+            lock.lock();
+            _done.clear();
+            return;
+        }
+        lock.lock();
+    }
+}
+
+}
+}
+
+#endif // __linux__
@@ -0,0 +1,195 @@
+// Copyright 2024 The Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef GOINCPP_IO_URING_HPP
+#define GOINCPP_IO_URING_HPP
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "../errors/errors.hpp"
+#include "../runtime/chan.hpp"
+#include "../runtime/executor.hpp"
+
+namespace goincpp {
+namespace io {
+
+#if defined(__linux__)
+
+// WriteCompletion reports the outcome of a write queued on a UringWriter.
+struct WriteCompletion {
+    // id is the value returned by Write or WriteAt.
+    uint64_t id = 0;
+    // n is the number of bytes written; it is less than the size of buf
+    // only if err is set.
+    std::size_t n = 0;
+    Error err;
+    // buf is the buffer that was written, handed back for reuse.
+    std::vector<char> buf;
+};
+
+struct UringWriterOptions {
+    // maxInFlight caps the writes queued or in flight. Write blocks while
+    // the cap is reached.
+    unsigned maxInFlight = 64;
+    // batch is the number of queued writes that are submitted together.
+    // Fewer are submitted by Submit and Flush.
+    unsigned batch = 16;
+    // onComplete, if set, is called with each completion, one at a time,
+    // on a thread of the writer. Otherwise completions are sent on the
+    // channel returned by Completions. Either way, a slow consumer holds
+    // up neither the writes nor Flush: completions queue up in between.
+    std::function<void(WriteCompletion)> onComplete;
+    // uring may be cleared to always use the thread-pool fallback.
+    bool uring = true;
+    // fallbackThreads is the size of the pool used when io_uring is not
+    // available. With more than one thread, appends to a descriptor that
+    // cannot seek may land out of order.
+    unsigned fallbackThreads = 1;
+};
+
+// UringWriter writes owned buffers to a file descriptor asynchronously, so
+// the calling thread neither copies the data nor makes a system call per
+// write.
+//
+// Writes are queued in the submission ring of an io_uring, set up with
+// raw system calls, and submitted to the kernel batch by batch. One thread
+// per writer reaps the completions, continues short writes, and reports
+// each write exactly once. Where io_uring is unavailable (old kernels,
+// seccomp filters, io_uring_disabled), a thread pool does the writes with
+// pwrite instead, with the same interface.
+//
+// Write appends: the writer keeps the file offset itself, so appends to a
+// regular file land in order even though they complete out of order. The
+// descriptor is not owned.
+//
+// A UringWriter may be used by multiple threads simultaneously.
+class UringWriter {
+public:
+    using Buffer = std::vector<char>;
+    using CompletionChannel = runtime::Channel<WriteCompletion, 64>;
+
+    explicit UringWriter(int fd, UringWriterOptions options = UringWriterOptions());
+
+    // The destructor flushes the writer, waiting for all queued writes.
+    // It then closes the completion channel; completions that do not fit
+    // in it by then are dropped.
+    ~UringWriter();
+
+    UringWriter(const UringWriter&) = delete;
+    UringWriter& operator=(const UringWriter&) = delete;
+
+    // Write queues buf to be appended. It returns the id its completion
+    // will carry. Write blocks while maxInFlight writes are in flight.
+    uint64_t Write(Buffer buf);
+
+    // WriteAt queues buf to be written at offset, leaving the append
+    // offset alone.
+    uint64_t WriteAt(Buffer buf, uint64_t offset);
+
+    // Submit hands the queued writes to the kernel, or to the pool.
+    void Submit();
+
+    // Flush submits the queued writes and waits until all writes queued so
+    // far have finished and, with onComplete, have been reported. It does
+    // not wait for completions sent on the channel to be received. Writes
+    // the kernel turns away for a lack of resources are submitted again,
+    // backing off in between.
+    void Flush();
+
+    // InFlight returns the number of writes queued or in flight, at most
+    // maxInFlight. Completed writes may still wait to be reported.
+    std::size_t InFlight() const;
+
+    // UsesUring reports whether writes go through io_uring rather than the
+    // fallback pool.
+    bool UsesUring() const { return _ring != nullptr; }
+
+    // Completions returns the channel completions are sent on, or nullptr
+    // if they are passed to onComplete.
+    std::shared_ptr<CompletionChannel> Completions() const { return _completions; }
+
+private:
+    struct Ring;
+
+    struct Request {
+        Buffer buf;
+        uint64_t id = 0;
+        // offset is where buf goes; positional is false for descriptors
+        // that cannot seek, which are written at their current position.
+        uint64_t offset = 0;
+        bool positional = true;
+        std::size_t done = 0;
+    };
+
+    uint64_t queue(Buffer buf, uint64_t offset, bool positional);
+    // submitLocked submits the queued writes; _mu must be held.
+    void submitLocked();
+    // waitLocked waits on cond, with _mu held by lock, until done returns
+    // true. Entries the kernel turns away meanwhile are submitted again,
+    // backing off in between.
+    void waitLocked(std::unique_lock<std::mutex>& lock, std::condition_variable& cond,
+                    const std::function<bool()>& done);
+    // prepare adds the rest of the write in slot to the submission ring.
+    void prepare(unsigned slot);
+    void reap();
+    // fail reports all outstanding writes with err once the ring cannot be
+    // used any more, closing it first so that the kernel lets go of the
+    // buffers in flight; later writes fail with err too.
+    void fail(Error err);
+    void writeFallback(unsigned slot);
+    // complete frees the slot and queues the completion of its write for
+    // deliver. It never blocks on the consumer.
+    void complete(unsigned slot, Error err);
+    // deliver passes the queued completions to onComplete or the channel,
+    // until _stop is closed and, for the channel, nothing more fits.
+    void deliver();
+
+    int _fd;
+    UringWriterOptions _options;
+    std::unique_ptr<Ring> _ring;
+    std::unique_ptr<runtime::ThreadPool> _pool;
+    std::shared_ptr<CompletionChannel> _completions;
+    // _stop is closed by the destructor to end deliver.
+    std::shared_ptr<runtime::UnbufferedChannel> _stop;
+
+    mutable std::mutex _mu;
+    std::condition_variable _slotFree;
+    std::condition_variable _idle;
+    std::condition_variable _doneReady;
+    std::vector<Request> _slots;
+    std::vector<unsigned> _free;
+    // _queued holds the slots of writes not submitted yet.
+    std::vector<unsigned> _queued;
+    // _unsubmitted counts the entries added to the submission ring and not
+    // yet passed to the kernel.
+    unsigned _unsubmitted = 0;
+    // _pending counts the writes Flush waits for.
+    std::size_t _pending = 0;
+    // _done holds the completions not delivered yet.
+    std::deque<WriteCompletion> _done;
+    uint64_t _nextId = 1;
+    uint64_t _append = 0;
+    bool _seekable = true;
+    // _err is the error that stopped the reaper, if any.
+    Error _err;
+    // _stopping is set once the destructor queued the stop no-op.
+    bool _stopping = false;
+
+    std::thread _reaper;
+    std::thread _deliverer;
+};
+
+#endif // __linux__
+
+}
+}
+
+#endif // GOINCPP_IO_URING_HPP
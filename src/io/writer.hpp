@@ -9,10 +9,16 @@
 #include <fstream>
 #include <vector>
 
+#include "../errors/errors.hpp"
+
 namespace goincpp {
 
 namespace io {
 
+// errShortWrite means that a write accepted fewer bytes than requested but
+// failed to return an explicit error.
+inline Error errShortWrite = errors::newError("short write");
+
 class Writer {
 private:
     std::ostream& _os;
@@ -6,113 +6,914 @@
 #define GOINCPP_RUNTIME_CHAN_HPP
 
 #include <iostream>
-#include <queue>
+#include <memory>
 #include <mutex>
-#include <condition_variable>
-#include <any>
+#include <vector>
+#include <span>
+#include <string>
+#include <atomic>
+#include <chrono>
+#include <coroutine>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+#include "executor.hpp"
+#include "ring.hpp"
+#include "stats.hpp"
+#include "waitq.hpp"
 
 namespace goincpp {
 namespace runtime {
 
-template <typename T, int Capacity>
-class Channel : public std::enable_shared_from_this< Channel<T, Capacity> > {
+class SelectCase;
+
+// ChanStatus is the outcome of a non-blocking or timed channel operation.
+// timeout means the operation could not complete in time, or at once for
+// the try variants; closed means the channel is closed (and, for a
+// receive, drained).
+enum class ChanStatus { ok, timeout, closed };
+
+// ChannelBase holds the state shared by every channel flavour: the lock and
+// the queues of blocked receivers and senders. select works on this
+// type-erased view so it can wait on channels of different element types.
+class ChannelBase {
 public:
-    static std::shared_ptr<Channel<T, Capacity>> make() {
-        auto cha = std::make_shared<Channel<T, Capacity>>();
-        return cha;
+    // Deadline is the absolute timeout of a timed operation. Timeouts are
+    // measured on the steady clock, so wall clock adjustments do not
+    // affect them.
+    using Deadline = std::chrono::steady_clock::time_point;
+
+    virtual ~ChannelBase() {
+        if (ChanStats* s = _stats.load(std::memory_order_acquire)) {
+            ChanRegistry::instance().remove(s);
+            delete s;
+        }
     }
 
-    void send() {
-        static_assert(Capacity == 0);
+    bool closed() const { return _closed.load(std::memory_order_acquire); }
+
+    // close wakes up every blocked sender and receiver. Buffered elements
+    // are still delivered to receivers afterwards. When nobody is blocked,
+    // close does not take the lock: a party about to block enqueues itself
+    // before checking the closed flag, so one of us sees the other.
+    void close() {
+        _closed.store(true, std::memory_order_release);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (_recvq.len() == 0 && _sendq.len() == 0) {
+            return;
+        }
+        std::vector<Waiter*> wakes;
         do {
-            std::lock_guard<std::mutex> lock(_mutex);
-            if (_closed) {
-                return;
+            std::lock_guard<std::mutex> lock(_lock);
+            while (Sudog* sg = _recvq.dequeue()) {
+                wakes.push_back(sg->waiter);
+            }
+            while (Sudog* sg = _sendq.dequeue()) {
+                wakes.push_back(sg->waiter);
             }
-            _queue.push(0);
-            _cond_sent.notify_all();
         } while(0);
-        std::unique_lock<std::mutex> lock(_mutex);
-        _cond_received.wait(lock, [this]() { return _queue.empty() || _closed; });
+        for (auto w : wakes) {
+            w->unpark();
+        }
+    }
+
+    // enableStats starts collecting stats for the channel and lists it,
+    // under name, in the registry read by channelStats. Channels without
+    // stats pay a single pointer test per operation. Enabling stats again
+    // has no effect.
+    void enableStats(std::string name) {
+        if (_stats.load(std::memory_order_acquire)) {
+            return;
+        }
+        auto s = new ChanStats(this, std::move(name), dataqsiz());
+        ChanStats* expected = nullptr;
+        if (!_stats.compare_exchange_strong(expected, s, std::memory_order_acq_rel)) {
+            delete s;
+            return;
+        }
+        ChanRegistry::instance().add(s);
+    }
+
+    // stats returns a snapshot of the channel's stats, or std::nullopt if
+    // they are not enabled.
+    std::optional<ChanStatsSnapshot> stats() const {
+        ChanStats* s = _stats.load(std::memory_order_acquire);
+        if (!s) {
+            return std::nullopt;
+        }
+        return s->snapshot(_sendq.len(), _recvq.len());
+    }
+
+protected:
+    friend class SelectCase;
+    friend class ChanAwaiter;
+
+    // dataqsiz is the capacity of the channel's buffer.
+    virtual std::size_t dataqsiz() const { return 0; }
+
+    // chanstats returns the channel's stats, or nullptr if not enabled.
+    ChanStats* chanstats() const { return _stats.load(std::memory_order_acquire); }
+
+    // statHandoff counts an element handed over directly from a sender to a
+    // receiver.
+    void statHandoff() {
+        if (ChanStats* s = chanstats()) {
+            s->addSends(1);
+            s->addReceives(1);
+        }
+    }
+
+    // sendLocked tries to complete a send of *elem without blocking; the
+    // caller holds _lock. *elem is moved from if movable is set, copied
+    // otherwise. It returns true once the send is finished, which includes
+    // dropping the value because the channel is closed, reported by setting
+    // *ok to false. A waiter that must be unparked after _lock is released
+    // is stored in *wake. Sudogs of self are never matched.
+    virtual bool sendLocked(void* elem, bool movable, bool* ok, const Waiter* self, Waiter** wake) = 0;
+
+    // recvLocked is the receive counterpart of sendLocked. *ok is set to
+    // false when the channel is closed and drained. A null elem discards
+    // the received value.
+    virtual bool recvLocked(void* elem, bool* ok, const Waiter* self, Waiter** wake) = 0;
+
+    // deadlineAfter turns a relative timeout into a steady clock deadline,
+    // rounding up so that a timed operation never gives up early.
+    template <typename Rep, typename Period>
+    static Deadline deadlineAfter(const std::chrono::duration<Rep, Period>& timeout) {
+        return std::chrono::steady_clock::now() + std::chrono::ceil<std::chrono::steady_clock::duration>(timeout);
+    }
+
+    // chansend blocks until *elem is sent, or dropped because the channel
+    // is closed, in which case it returns false.
+    bool chansend(void* elem, bool movable) {
+        return chansend(elem, movable, nullptr) == ChanStatus::ok;
+    }
+
+    // chansend with a deadline gives up once *deadline has passed. A null
+    // deadline waits forever.
+    ChanStatus chansend(void* elem, bool movable, const Deadline* deadline) {
+        Waiter w;
+        Sudog sg;
+        sg.waiter = &w;
+        sg.elem = elem;
+        sg.movable = movable;
+        return chanblock(_sendq, sg, deadline, [&](bool* ok, Waiter** wake) {
+            return sendLocked(elem, movable, ok, &w, wake);
+        });
+    }
+
+    // chanrecv blocks until a value is received into *elem, or until the
+    // channel is closed and drained, in which case it returns false.
+    bool chanrecv(void* elem) {
+        return chanrecv(elem, nullptr) == ChanStatus::ok;
+    }
+
+    ChanStatus chanrecv(void* elem, const Deadline* deadline) {
+        Waiter w;
+        Sudog sg;
+        sg.waiter = &w;
+        sg.elem = elem;
+        return chanblock(_recvq, sg, deadline, [&](bool* ok, Waiter** wake) {
+            return recvLocked(elem, ok, &w, wake);
+        });
+    }
+
+    // chantrysend and chantryrecv attempt the operation once under the
+    // lock, without queueing. They report timeout if it would block.
+    ChanStatus chantrysend(void* elem, bool movable) {
+        return chantry([&](bool* ok, Waiter** wake) {
+            return sendLocked(elem, movable, ok, nullptr, wake);
+        });
     }
 
-    void send(const T& message) {
-        static_assert(Capacity > 0);
+    ChanStatus chantryrecv(void* elem) {
+        return chantry([&](bool* ok, Waiter** wake) {
+            return recvLocked(elem, ok, nullptr, wake);
+        });
+    }
+
+    // wakeup wakes up to n parties blocked on q, taking the lock once. It
+    // is called by the lock-free paths after they changed the buffer by n
+    // elements: the seq_cst fence pairs with the enqueue of a blocked party,
+    // which re-checks the buffer under _lock, so either that party sees our
+    // update or we see it queued.
+    void wakeup(WaitQueue& q, std::size_t n = 1) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (q.len() == 0) {
+            return;
+        }
+        Waiter* first = nullptr;
+        std::vector<Waiter*> rest;
         do {
-            std::lock_guard<std::mutex> lock(_mutex);
-            if (_closed) {
-                return;
+            std::lock_guard<std::mutex> lock(_lock);
+            for (std::size_t i = 0; i < n; i++) {
+                Sudog* sg = q.dequeue();
+                if (!sg) {
+                    break;
+                }
+                if (i == 0) {
+                    first = sg->waiter;
+                } else {
+                    rest.push_back(sg->waiter);
+                }
             }
-            _queue.push(message);
-            _cond_sent.notify_all();
         } while(0);
+        if (first) {
+            first->unpark();
+        }
+        for (auto w : rest) {
+            w->unpark();
+        }
     }
 
-    bool select() {
-        static_assert(Capacity == 0);
-        do {
-            std::unique_lock<std::mutex> lock(_mutex);
-            if (_closed) {
-                return true;
+private:
+    // chanblock runs op, a sendLocked or recvLocked attempt, with sg queued
+    // on q until it succeeds, parking sg's waiter between attempts.
+    //
+    // When the deadline passes, the waiter takes itself off q under the
+    // lock. If it is no longer queued, a waker claimed it just in time: the
+    // pending unpark is consumed and the wake-up is handled as usual, so a
+    // hand-off already performed on its behalf is never lost.
+    template <typename Op>
+    ChanStatus chanblock(WaitQueue& q, Sudog& sg, const Deadline* deadline, Op&& op) {
+        Waiter& w = *sg.waiter;
+        ChanStats* stats = nullptr;
+        std::chrono::steady_clock::time_point start;
+        auto finish = [&](ChanStatus status) {
+            if (stats) {
+                stats->addWait(std::chrono::steady_clock::now() - start);
+            }
+            return status;
+        };
+        for (;;) {
+            Waiter* wake = nullptr;
+            bool ok = false;
+            std::unique_lock<std::mutex> lock(_lock);
+            w.reset();
+            q.enqueue(&sg);
+            if (op(&ok, &wake)) {
+                q.remove(&sg);
+                lock.unlock();
+                if (wake) {
+                    wake->unpark();
+                }
+                return finish(ok ? ChanStatus::ok : ChanStatus::closed);
+            }
+            lock.unlock();
+            if (!stats && (stats = chanstats())) {
+                start = std::chrono::steady_clock::now();
+                stats->addBlocked(&q == &_sendq);
             }
-            _cond_sent.wait_for(lock, std::chrono::seconds(0),
-                [this]() { return !_queue.empty() || _closed;});
-            if (!_queue.empty()) {
-                _queue.pop();
-                _cond_received.notify_all();
+            if (!deadline) {
+                w.park();
+            } else if (!w.parkUntil(*deadline)) {
+                lock.lock();
+                bool queued = sg.queued;
+                q.remove(&sg);
+                lock.unlock();
+                if (queued) {
+                    return finish(ChanStatus::timeout);
+                }
+                w.park();
             }
+            if (sg.completed) {
+                return finish(ChanStatus::ok);
+            }
+        }
+    }
+
+    template <typename Op>
+    ChanStatus chantry(Op&& op) {
+        Waiter* wake = nullptr;
+        bool ok = false;
+        bool done;
+        do {
+            std::lock_guard<std::mutex> lock(_lock);
+            done = op(&ok, &wake);
         } while(0);
+        if (wake) {
+            wake->unpark();
+        }
+        if (!done) {
+            return ChanStatus::timeout;
+        }
+        return ok ? ChanStatus::ok : ChanStatus::closed;
+    }
+
+protected:
+    std::mutex _lock;
+    WaitQueue _recvq;
+    WaitQueue _sendq;
+    std::atomic<bool> _closed{false};
+    std::atomic<ChanStats*> _stats{nullptr};
+};
+
+// channelStats returns a snapshot of every live channel with stats enabled,
+// for export to a metrics system.
+inline std::vector<ChanStatsSnapshot> channelStats() {
+    std::vector<ChanStatsSnapshot> snaps;
+    ChanRegistry::instance().forEach([&snaps](ChannelBase* c) {
+        if (auto s = c->stats()) {
+            snaps.push_back(std::move(*s));
+        }
+    });
+    return snaps;
+}
+
+// ChanAwaiter performs a channel operation on behalf of a suspended
+// coroutine. Instead of parking a thread, its Waiter calls back when it is
+// claimed; the awaiter then finishes or retries the operation on the
+// executor and resumes the coroutine there. The typed awaiters returned by
+// asyncSend, asyncReceive and co_await on a channel derive from it.
+class ChanAwaiter {
+public:
+    ChanAwaiter(const ChanAwaiter&) = delete;
+    ChanAwaiter& operator=(const ChanAwaiter&) = delete;
+
+protected:
+    ChanAwaiter(ChannelBase* c, bool send, Executor& ex) : _c(c), _send(send), _ex(ex) {}
 
+    // suspend queues the operation on elem and returns true, or completes it
+    // right away and returns false, in which case the coroutine goes on
+    // without being suspended. Once queued, the coroutine may be resumed
+    // on another thread before suspend returns.
+    bool suspend(std::coroutine_handle<> h, void* elem, bool movable) {
+        _h = h;
+        _sg.waiter = &_w;
+        _sg.elem = elem;
+        _sg.movable = movable;
+        _w.onUnpark(&ChanAwaiter::woken, this);
+        // Once attempt leaves the awaiter queued, its members are no longer
+        // ours to touch; count the block with copies.
+        ChanStats* stats = _c->chanstats();
+        bool send = _send;
+        if (stats) {
+            _start = std::chrono::steady_clock::now();
+        }
+        if (attempt()) {
+            return false;
+        }
+        if (stats) {
+            stats->addBlocked(send);
+        }
         return true;
     }
 
-    bool receive() {
-        static_assert(Capacity == 0);
-        do {
-            std::unique_lock<std::mutex> lock(_mutex);
-            _cond_sent.wait(lock, [this]() { return !_queue.empty() || _closed; });
-            if (_closed) {
-                return true;
-            }
-            if (!_queue.empty()) {
-                _queue.pop();
-                _cond_received.notify_all();
+    ChanStatus _status = ChanStatus::ok;
+
+private:
+    // attempt tries the operation with the awaiter queued, like the loop of
+    // a blocking operation, and leaves it queued if it cannot complete.
+    bool attempt() {
+        Waiter* wake = nullptr;
+        bool ok = false;
+        WaitQueue& q = _send ? _c->_sendq : _c->_recvq;
+        std::unique_lock<std::mutex> lock(_c->_lock);
+        _w.reset();
+        q.enqueue(&_sg);
+        bool done = _send ? _c->sendLocked(_sg.elem, _sg.movable, &ok, &_w, &wake)
+                          : _c->recvLocked(_sg.elem, &ok, &_w, &wake);
+        if (!done) {
+            return false;
+        }
+        q.remove(&_sg);
+        lock.unlock();
+        _status = ok ? ChanStatus::ok : ChanStatus::closed;
+        if (wake) {
+            wake->unpark();
+        }
+        return true;
+    }
+
+    // woken runs on the thread of whoever claimed the waiter. The retry is
+    // deferred to the executor so that chains of wake-ups never recurse.
+    static void woken(void* arg) {
+        auto self = static_cast<ChanAwaiter*>(arg);
+        self->_ex.post([self]() { self->retry(); });
+    }
+
+    void retry() {
+        if (_sg.completed) {
+            _status = ChanStatus::ok;
+        } else if (!attempt()) {
+            return;
+        }
+        if (ChanStats* stats = _c->chanstats()) {
+            stats->addWait(std::chrono::steady_clock::now() - _start);
+        }
+        _h.resume();
+    }
+
+    ChannelBase* _c;
+    bool _send;
+    Executor& _ex;
+    std::coroutine_handle<> _h;
+    Waiter _w;
+    Sudog _sg;
+    std::chrono::steady_clock::time_point _start;
+};
+
+// RecvAwaiter is the awaiter of a receive. co_await yields the received
+// value, or std::nullopt once the channel is closed and drained.
+template <typename C, typename T>
+class RecvAwaiter : public ChanAwaiter {
+public:
+    RecvAwaiter(C* c, Executor& ex) : ChanAwaiter(c, false, ex), _c(c) {}
+
+    bool await_ready() {
+        if (_c->tryReceive(_value) == ChanStatus::ok) {
+            _status = ChanStatus::ok;
+            return true;
+        }
+        return false;
+    }
+
+    bool await_suspend(std::coroutine_handle<> h) {
+        return suspend(h, &_value, false);
+    }
+
+    std::optional<T> await_resume() {
+        if (_status != ChanStatus::ok) {
+            return std::nullopt;
+        }
+        return std::optional<T>(std::move(_value));
+    }
+
+private:
+    C* _c;
+    T _value{};
+};
+
+// SendAwaiter is the awaiter of a send. co_await yields false if the value
+// was dropped because the channel is closed.
+template <typename C, typename T>
+class SendAwaiter : public ChanAwaiter {
+public:
+    SendAwaiter(C* c, T value, Executor& ex) : ChanAwaiter(c, true, ex), _c(c), _value(std::move(value)) {}
+
+    bool await_ready() {
+        _status = _c->trySend(std::move(_value));
+        return _status != ChanStatus::timeout;
+    }
+
+    bool await_suspend(std::coroutine_handle<> h) {
+        return suspend(h, &_value, true);
+    }
+
+    bool await_resume() const { return _status == ChanStatus::ok; }
+
+private:
+    C* _c;
+    T _value;
+};
+
+// SignalAwaiter waits for a signal on, or the close of, a Signal channel.
+// Like a receive from a nil channel in Go, awaiting a null channel never
+// completes.
+template <typename C>
+class SignalAwaiter : public ChanAwaiter {
+public:
+    SignalAwaiter(C* c, Executor& ex) : ChanAwaiter(c, false, ex), _c(c) {}
+
+    bool await_ready() {
+        if (!_c) {
+            return false;
+        }
+        _status = _c->tryReceive();
+        return _status != ChanStatus::timeout;
+    }
+
+    bool await_suspend(std::coroutine_handle<> h) {
+        if (!_c) {
+            return true;
+        }
+        return suspend(h, nullptr, false);
+    }
+
+    void await_resume() const {}
+
+private:
+    C* _c;
+};
+
+// handoff hands the sender's *elem to sink, by move if movable is set and by
+// copy otherwise. Move-only element types are always sent movable.
+template <typename T, typename Sink>
+bool handoff(void* elem, bool movable, Sink&& sink) {
+    T* value = static_cast<T*>(elem);
+    if constexpr (std::is_copy_constructible_v<T>) {
+        if (!movable) {
+            return sink(static_cast<const T&>(*value));
+        }
+    }
+    return sink(std::move(*value));
+}
+
+// Channel is a buffered channel holding at most Capacity elements.
+// Elements live in a lock-free ring; the channel lock is only taken when a
+// sender finds the buffer full or a receiver finds it empty and has to
+// block, or when the other side has such a blocked party to wake up.
+//
+// Policy tells how many threads use each end of the channel: Mpmc (the
+// default), Mpsc or Spsc. With Spsc the fast paths of send and receive
+// perform no atomic read-modify-write at all. Select cases count as
+// senders or receivers like plain operations do.
+template <typename T, int Capacity, typename Policy = Mpmc>
+class Channel : public ChannelBase, public std::enable_shared_from_this< Channel<T, Capacity, Policy> > {
+    static_assert(Capacity >= 0, "Channel capacity must not be negative");
+
+public:
+    static std::shared_ptr<Channel<T, Capacity, Policy>> make() {
+        auto cha = std::make_shared<Channel<T, Capacity, Policy>>();
+        return cha;
+    }
+
+    // send blocks while the buffer is full. Sending on a closed channel
+    // drops the message.
+    void send(const T& message) requires std::is_copy_constructible_v<T> {
+        if (!closed() && push(message)) {
+            wakeup(_recvq);
+            return;
+        }
+        chansend(const_cast<T*>(&message), false);
+    }
+
+    // send moves message into the channel; it is only moved from once it
+    // has been accepted.
+    void send(T&& message) {
+        if (!closed() && push(std::move(message))) {
+            wakeup(_recvq);
+            return;
+        }
+        chansend(&message, true);
+    }
+
+    // emplace constructs the element directly in the buffer. If the buffer
+    // is full, the element is constructed once and moved in when space
+    // frees up.
+    template <typename... Args>
+    void emplace(Args&&... args) {
+        if (closed()) {
+            return;
+        }
+        if (push(std::forward<Args>(args)...)) {
+            wakeup(_recvq);
+            return;
+        }
+        T message(std::forward<Args>(args)...);
+        chansend(&message, true);
+    }
+
+    // receive blocks while the buffer is empty, then moves the oldest
+    // element into message. Buffered elements are still delivered after
+    // close; once drained, receive returns without touching message.
+    bool receive(T& message) {
+        if (pop(message)) {
+            wakeup(_sendq);
+            return true;
+        }
+        chanrecv(&message);
+        return true;
+    }
+
+    // trySend sends message only if there is room in the buffer right now.
+    ChanStatus trySend(const T& message) requires std::is_copy_constructible_v<T> {
+        return sendUntil(const_cast<T*>(&message), false, nullptr);
+    }
+
+    // trySend with an rvalue moves message only if it is accepted.
+    ChanStatus trySend(T&& message) {
+        return sendUntil(&message, true, nullptr);
+    }
+
+    // sendFor blocks at most for timeout while the buffer is full.
+    template <typename Rep, typename Period>
+    ChanStatus sendFor(const T& message, const std::chrono::duration<Rep, Period>& timeout)
+        requires std::is_copy_constructible_v<T> {
+        auto deadline = deadlineAfter(timeout);
+        return sendUntil(const_cast<T*>(&message), false, &deadline);
+    }
+
+    template <typename Rep, typename Period>
+    ChanStatus sendFor(T&& message, const std::chrono::duration<Rep, Period>& timeout) {
+        auto deadline = deadlineAfter(timeout);
+        return sendUntil(&message, true, &deadline);
+    }
+
+    // sendUntil blocks until deadline at the latest while the buffer is
+    // full.
+    ChanStatus sendUntil(const T& message, Deadline deadline) requires std::is_copy_constructible_v<T> {
+        return sendUntil(const_cast<T*>(&message), false, &deadline);
+    }
+
+    ChanStatus sendUntil(T&& message, Deadline deadline) {
+        return sendUntil(&message, true, &deadline);
+    }
+
+    // tryReceive receives a buffered element, if any, without blocking.
+    ChanStatus tryReceive(T& message) {
+        if (pop(message)) {
+            wakeup(_sendq);
+            return ChanStatus::ok;
+        }
+        if (!closed()) {
+            return ChanStatus::timeout;
+        }
+        // Elements sent before close are still delivered.
+        return pop(message) ? ChanStatus::ok : ChanStatus::closed;
+    }
+
+    // receiveFor blocks at most for timeout while the buffer is empty.
+    template <typename Rep, typename Period>
+    ChanStatus receiveFor(T& message, const std::chrono::duration<Rep, Period>& timeout) {
+        return receiveUntil(message, deadlineAfter(timeout));
+    }
+
+    // receiveUntil blocks until deadline at the latest while the buffer is
+    // empty.
+    ChanStatus receiveUntil(T& message, Deadline deadline) {
+        if (pop(message)) {
+            wakeup(_sendq);
+            return ChanStatus::ok;
+        }
+        return chanrecv(&message, &deadline);
+    }
+
+    // sendN sends all of values, blocking while the buffer is full. Each run
+    // of elements that fits into the free slots is pushed with a single
+    // index update and followed by a single wake-up of as many blocked
+    // receivers. It returns the number of elements sent, which is less than
+    // values.size() only if the channel was closed.
+    std::size_t sendN(std::span<const T> values) {
+        std::size_t sent = 0;
+        while (sent < values.size() && !closed()) {
+            auto n = pushN(values.data() + sent, values.size() - sent);
+            if (n > 0) {
+                sent += n;
+                wakeup(_recvq, n);
+            } else if (chansend(const_cast<T*>(&values[sent]), false)) {
+                sent++;
             } else {
-                return false;
+                break;
             }
-        } while(0);
+        }
+        return sent;
+    }
+
+    // receiveN blocks until at least one element is available, then moves
+    // as many buffered elements as fit into values in one pass and wakes up
+    // as many blocked senders. It returns the number of elements received;
+    // 0 means the channel is closed and drained.
+    std::size_t receiveN(std::span<T> values) {
+        if (values.empty()) {
+            return 0;
+        }
+        auto n = popN(values.data(), values.size());
+        if (n > 0) {
+            wakeup(_sendq, n);
+            return n;
+        }
+        if (!chanrecv(&values[0])) {
+            return 0;
+        }
+        // chanrecv already woke a sender for the first element.
+        n = popN(values.data() + 1, values.size() - 1);
+        if (n > 0) {
+            wakeup(_sendq, n);
+        }
+        return n + 1;
+    }
 
+    // asyncSend and asyncReceive are the coroutine forms of send and
+    // receive: co_await suspends the coroutine instead of blocking the
+    // thread, and resumes it on ex once the operation completed.
+    //
+    //	if (auto v = co_await ch->asyncReceive()) { ... }
+    SendAwaiter<Channel, T> asyncSend(T message, Executor& ex = defaultExecutor()) {
+        return SendAwaiter<Channel, T>(this, std::move(message), ex);
+    }
+
+    RecvAwaiter<Channel, T> asyncReceive(Executor& ex = defaultExecutor()) {
+        return RecvAwaiter<Channel, T>(this, ex);
+    }
+
+    // len returns the number of elements queued in the buffer.
+    std::size_t len() const { return _buf.size(); }
+
+    // cap returns the buffer capacity.
+    static constexpr std::size_t cap() { return Capacity; }
+
+    auto operator<<(T value) {
+        send(std::move(value));
+        return this->shared_from_this();
+    }
+
+    auto operator>>(T& value) {
+        return receive(value);
+    }
+
+protected:
+    bool sendLocked(void* elem, bool movable, bool* ok, const Waiter* self, Waiter** wake) override {
+        if (closed()) {
+            *ok = false;
+            return true;
+        }
+        if (!handoff<T>(elem, movable, [this](auto&& value) {
+                return push(std::forward<decltype(value)>(value));
+            })) {
+            return false;
+        }
+        if (Sudog* sg = _recvq.dequeue(self)) {
+            *wake = sg->waiter;
+        }
+        *ok = true;
         return true;
     }
 
-    bool receive(T& message) {
-        static_assert(Capacity > 0);
-        do {
-            std::unique_lock<std::mutex> lock(_mutex);
-            _cond_sent.wait(lock, [this]() { return !_queue.empty() || _closed; });
-            if (_closed) {
-                return true;
+    bool recvLocked(void* elem, bool* ok, const Waiter* self, Waiter** wake) override {
+        if (pop(*static_cast<T*>(elem))) {
+            if (Sudog* sg = _sendq.dequeue(self)) {
+                *wake = sg->waiter;
             }
-            if (!_queue.empty()) {
-                message = _queue.front();
-                _queue.pop();
-            } else {
-                return false;
+            *ok = true;
+            return true;
+        }
+        if (closed()) {
+            *ok = false;
+            return true;
+        }
+        return false;
+    }
+
+    std::size_t dataqsiz() const override { return Capacity; }
+
+private:
+    // push, pop, pushN and popN are the ring operations, plus the stats.
+    template <typename... Args>
+    bool push(Args&&... args) {
+        if (!_buf.tryEmplace(std::forward<Args>(args)...)) {
+            return false;
+        }
+        pushed(1);
+        return true;
+    }
+
+    bool pop(T& value) {
+        if (!_buf.tryPop(value)) {
+            return false;
+        }
+        if (ChanStats* s = chanstats()) {
+            s->addReceives(1);
+        }
+        return true;
+    }
+
+    std::size_t pushN(const T* values, std::size_t n) {
+        n = _buf.tryPushN(values, n);
+        if (n > 0) {
+            pushed(n);
+        }
+        return n;
+    }
+
+    std::size_t popN(T* values, std::size_t n) {
+        n = _buf.tryPopN(values, n);
+        if (n > 0) {
+            if (ChanStats* s = chanstats()) {
+                s->addReceives(n);
             }
-        } while(0);
+        }
+        return n;
+    }
+
+    void pushed(std::size_t n) {
+        if (ChanStats* s = chanstats()) {
+            s->addSends(n);
+            s->observeDepth(_buf.size());
+        }
+    }
+
+    // sendUntil is the common part of the try and timed sends; a null
+    // deadline makes it non-blocking.
+    ChanStatus sendUntil(void* elem, bool movable, const Deadline* deadline) {
+        if (closed()) {
+            return ChanStatus::closed;
+        }
+        if (handoff<T>(elem, movable, [this](auto&& value) {
+                return push(std::forward<decltype(value)>(value));
+            })) {
+            wakeup(_recvq);
+            return ChanStatus::ok;
+        }
+        if (!deadline) {
+            return closed() ? ChanStatus::closed : ChanStatus::timeout;
+        }
+        return chansend(elem, movable, deadline);
+    }
+
+    RingBuffer<T, static_cast<std::size_t>(Capacity), Policy> _buf;
+};
+
+// Channel<T, 0> is an unbuffered channel: a sender and a receiver meet and
+// the value is handed over directly from one to the other, without any
+// intermediate storage in the channel. Every operation goes through the
+// channel lock, so Policy makes no difference here.
+template <typename T, typename Policy>
+class Channel<T, 0, Policy> : public ChannelBase, public std::enable_shared_from_this< Channel<T, 0, Policy> > {
+public:
+    static std::shared_ptr<Channel<T, 0, Policy>> make() {
+        auto cha = std::make_shared<Channel<T, 0, Policy>>();
+        return cha;
+    }
+
+    // send blocks until a receiver has taken message. Sending on a closed
+    // channel drops the message.
+    void send(const T& message) requires std::is_copy_constructible_v<T> {
+        chansend(const_cast<T*>(&message), false);
+    }
+
+    // send moves message to the receiver it meets.
+    void send(T&& message) {
+        chansend(&message, true);
+    }
+
+    template <typename... Args>
+    void emplace(Args&&... args) {
+        T message(std::forward<Args>(args)...);
+        chansend(&message, true);
+    }
 
+    // receive blocks until a sender hands over a value, which is moved into
+    // message. Once the channel is closed, receive returns without touching
+    // message.
+    bool receive(T& message) {
+        chanrecv(&message);
         return true;
     }
 
-    void close() {
-        std::lock_guard<std::mutex> lock(_mutex);
-        _closed = true;
-        _cond_sent.notify_all();
-        _cond_received.notify_all();
+    // trySend hands message over only if a receiver is already waiting.
+    ChanStatus trySend(const T& message) requires std::is_copy_constructible_v<T> {
+        return chantrysend(const_cast<T*>(&message), false);
+    }
+
+    ChanStatus trySend(T&& message) {
+        return chantrysend(&message, true);
+    }
+
+    // sendFor waits at most for timeout for a receiver.
+    template <typename Rep, typename Period>
+    ChanStatus sendFor(const T& message, const std::chrono::duration<Rep, Period>& timeout)
+        requires std::is_copy_constructible_v<T> {
+        return sendUntil(message, deadlineAfter(timeout));
+    }
+
+    template <typename Rep, typename Period>
+    ChanStatus sendFor(T&& message, const std::chrono::duration<Rep, Period>& timeout) {
+        return sendUntil(std::move(message), deadlineAfter(timeout));
     }
 
+    // sendUntil waits until deadline at the latest for a receiver. On
+    // timeout, message is left untouched.
+    ChanStatus sendUntil(const T& message, Deadline deadline) requires std::is_copy_constructible_v<T> {
+        return chansend(const_cast<T*>(&message), false, &deadline);
+    }
+
+    ChanStatus sendUntil(T&& message, Deadline deadline) {
+        return chansend(&message, true, &deadline);
+    }
+
+    // tryReceive takes a value only if a sender is already waiting.
+    ChanStatus tryReceive(T& message) {
+        return chantryrecv(&message);
+    }
+
+    // receiveFor waits at most for timeout for a sender.
+    template <typename Rep, typename Period>
+    ChanStatus receiveFor(T& message, const std::chrono::duration<Rep, Period>& timeout) {
+        return receiveUntil(message, deadlineAfter(timeout));
+    }
+
+    // receiveUntil waits until deadline at the latest for a sender.
+    ChanStatus receiveUntil(T& message, Deadline deadline) {
+        return chanrecv(&message, &deadline);
+    }
+
+    // asyncSend and asyncReceive are the coroutine forms of send and
+    // receive, see Channel.
+    SendAwaiter<Channel, T> asyncSend(T message, Executor& ex = defaultExecutor()) {
+        return SendAwaiter<Channel, T>(this, std::move(message), ex);
+    }
+
+    RecvAwaiter<Channel, T> asyncReceive(Executor& ex = defaultExecutor()) {
+        return RecvAwaiter<Channel, T>(this, ex);
+    }
+
+    static constexpr std::size_t len() { return 0; }
+    static constexpr std::size_t cap() { return 0; }
+
     auto operator<<(T value) {
-        send(value);
+        send(std::move(value));
         return this->shared_from_this();
     }
 
@@ -120,29 +921,206 @@ public:
         return receive(value);
     }
 
-private:
-    std::queue<T> _queue;
-    std::mutex _mutex;
-    std::condition_variable _cond_sent;
-    std::condition_variable _cond_received;
-    bool _closed = false;
+protected:
+    bool sendLocked(void* elem, bool movable, bool* ok, const Waiter* self, Waiter** wake) override {
+        if (closed()) {
+            *ok = false;
+            return true;
+        }
+        Sudog* sg = _recvq.dequeue(self);
+        if (!sg) {
+            return false;
+        }
+        if (sg->elem) {
+            handoff<T>(elem, movable, [sg](auto&& value) {
+                *static_cast<T*>(sg->elem) = std::forward<decltype(value)>(value);
+                return true;
+            });
+        }
+        sg->completed = true;
+        *wake = sg->waiter;
+        *ok = true;
+        statHandoff();
+        return true;
+    }
+
+    bool recvLocked(void* elem, bool* ok, const Waiter* self, Waiter** wake) override {
+        if (Sudog* sg = _sendq.dequeue(self)) {
+            if (elem) {
+                handoff<T>(sg->elem, sg->movable, [elem](auto&& value) {
+                    *static_cast<T*>(elem) = std::forward<decltype(value)>(value);
+                    return true;
+                });
+            }
+            sg->completed = true;
+            *wake = sg->waiter;
+            *ok = true;
+            statHandoff();
+            return true;
+        }
+        if (closed()) {
+            *ok = false;
+            return true;
+        }
+        return false;
+    }
 };
 
-using UnbufferedChannel = Channel<std::any, 0>;
+// Signal is the element type of channels that carry no data, like Go's
+// chan struct{}.
+struct Signal {};
+
+// Channel<Signal, 0> signals events. It stores no payload at all: its
+// only state is the closed flag, which is read without locking, plus the
+// queues its parties wait on. Once closed, receive and select return
+// immediately; this is what Context.done() channels rely on.
+template <typename Policy>
+class Channel<Signal, 0, Policy> : public ChannelBase, public std::enable_shared_from_this< Channel<Signal, 0, Policy> > {
+public:
+    static std::shared_ptr<Channel<Signal, 0, Policy>> make() {
+        auto cha = std::make_shared<Channel<Signal, 0, Policy>>();
+        return cha;
+    }
 
+    // send blocks until a receiver has taken the signal, or the channel is
+    // closed.
+    void send() {
+        if (!closed()) {
+            chansend(nullptr, false);
+        }
+    }
 
+    // select receives a pending signal, if any, without blocking.
+    bool select() {
+        if (closed()) {
+            return true;
+        }
+        Waiter* wake = nullptr;
+        bool ok;
+        do {
+            std::lock_guard<std::mutex> lock(_lock);
+            recvLocked(nullptr, &ok, nullptr, &wake);
+        } while(0);
+        if (wake) {
+            wake->unpark();
+        }
+        return true;
+    }
+
+    // receive blocks until a signal is sent or the channel is closed.
+    bool receive() {
+        if (!closed()) {
+            chanrecv(nullptr);
+        }
+        return true;
+    }
+
+    // trySend, sendFor and sendUntil deliver a signal only if a receiver
+    // shows up in time.
+    ChanStatus trySend() {
+        return chantrysend(nullptr, false);
+    }
+
+    template <typename Rep, typename Period>
+    ChanStatus sendFor(const std::chrono::duration<Rep, Period>& timeout) {
+        return sendUntil(deadlineAfter(timeout));
+    }
+
+    ChanStatus sendUntil(Deadline deadline) {
+        return chansend(nullptr, false, &deadline);
+    }
+
+    // tryReceive, receiveFor and receiveUntil wait for a signal, or for the
+    // channel to be closed, no longer than told.
+    ChanStatus tryReceive() {
+        if (closed()) {
+            return ChanStatus::closed;
+        }
+        return chantryrecv(nullptr);
+    }
+
+    template <typename Rep, typename Period>
+    ChanStatus receiveFor(const std::chrono::duration<Rep, Period>& timeout) {
+        return receiveUntil(deadlineAfter(timeout));
+    }
+
+    ChanStatus receiveUntil(Deadline deadline) {
+        if (closed()) {
+            return ChanStatus::closed;
+        }
+        return chanrecv(nullptr, &deadline);
+    }
+
+    // asyncReceive is the coroutine form of receive; co_await on the
+    // channel itself does the same on the default executor.
+    SignalAwaiter<Channel> asyncReceive(Executor& ex = defaultExecutor()) {
+        return SignalAwaiter<Channel>(this, ex);
+    }
+
+protected:
+    bool sendLocked(void*, bool, bool* ok, const Waiter* self, Waiter** wake) override {
+        if (closed()) {
+            *ok = false;
+            return true;
+        }
+        Sudog* sg = _recvq.dequeue(self);
+        if (!sg) {
+            return false;
+        }
+        sg->completed = true;
+        *wake = sg->waiter;
+        *ok = true;
+        statHandoff();
+        return true;
+    }
+
+    bool recvLocked(void*, bool* ok, const Waiter* self, Waiter** wake) override {
+        if (Sudog* sg = _sendq.dequeue(self)) {
+            sg->completed = true;
+            *wake = sg->waiter;
+            *ok = true;
+            statHandoff();
+            return true;
+        }
+        if (closed()) {
+            *ok = false;
+            return true;
+        }
+        return false;
+    }
+};
+
+using UnbufferedChannel = Channel<Signal, 0>;
+
+// co_await on a Signal channel suspends the coroutine until a signal is
+// received or the channel is closed, e.g. co_await ctx->done().
+template <typename Policy>
+SignalAwaiter<Channel<Signal, 0, Policy>> operator co_await(const std::shared_ptr<Channel<Signal, 0, Policy>>& channel) {
+    return SignalAwaiter<Channel<Signal, 0, Policy>>(channel.get(), defaultExecutor());
+}
+
+// SpscChannel is a channel used by exactly one sending and one receiving
+// thread at a time.
 template <typename T, int Capacity>
-auto operator<<(std::shared_ptr<Channel<T, Capacity>> channel, T value) {
-    channel->send(value);
+using SpscChannel = Channel<T, Capacity, Spsc>;
+
+// MpscChannel is a channel with any number of senders and a single
+// receiving thread.
+template <typename T, int Capacity>
+using MpscChannel = Channel<T, Capacity, Mpsc>;
+
+template <typename T, int Capacity, typename Policy>
+auto operator<<(std::shared_ptr<Channel<T, Capacity, Policy>> channel, T value) {
+    channel->send(std::move(value));
     return channel;
 }
 
-template <typename T, int Capacity>
-auto operator>>(std::shared_ptr<Channel<T, Capacity>> channel, T& value) {
+template <typename T, int Capacity, typename Policy>
+auto operator>>(std::shared_ptr<Channel<T, Capacity, Policy>> channel, T& value) {
     return channel->receive(value);
 }
 
 }
 }
 
-#endif // GOINCPP_RUNTIME_CHAN_HPP
\ No newline at end of file
+#endif // GOINCPP_RUNTIME_CHAN_HPP
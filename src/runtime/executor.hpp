@@ -0,0 +1,107 @@
+// Copyright 2024 The Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef GOINCPP_RUNTIME_EXECUTOR_HPP
+#define GOINCPP_RUNTIME_EXECUTOR_HPP
+
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "park.hpp"
+
+namespace goincpp {
+namespace runtime {
+
+// Executor runs work posted from any thread, typically the resumption of a
+// coroutine whose channel operation completed.
+class Executor {
+public:
+    virtual ~Executor() = default;
+
+    // post schedules fn to run on one of the executor's threads.
+    virtual void post(std::function<void()> fn) = 0;
+
+    // resume schedules h to be resumed.
+    void resume(std::coroutine_handle<> h) {
+        post([h]() { h.resume(); });
+    }
+};
+
+// ThreadPool is an Executor backed by a fixed number of threads sharing a
+// FIFO of work. Work still queued when the pool is destroyed is run before
+// its threads exit.
+class ThreadPool : public Executor {
+public:
+    explicit ThreadPool(unsigned nthreads = ncpu()) {
+        if (nthreads == 0) {
+            nthreads = 1;
+        }
+        for (unsigned i = 0; i < nthreads; i++) {
+            _threads.emplace_back([this]() { run(); });
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    ~ThreadPool() override {
+        do {
+            std::lock_guard<std::mutex> lock(_mu);
+            _stopping = true;
+        } while(0);
+        _cond.notify_all();
+        for (auto& thd : _threads) {
+            thd.join();
+        }
+    }
+
+    void post(std::function<void()> fn) override {
+        do {
+            std::lock_guard<std::mutex> lock(_mu);
+            _queue.push_back(std::move(fn));
+        } while(0);
+        _cond.notify_one();
+    }
+
+private:
+    void run() {
+        for (;;) {
+            std::function<void()> fn;
+            do {
+                std::unique_lock<std::mutex> lock(_mu);
+                _cond.wait(lock, [this]() { return _stopping || !_queue.empty(); });
+                if (_queue.empty()) {
+                    return;
+                }
+                fn = std::move(_queue.front());
+                _queue.pop_front();
+            } while(0);
+            fn();
+        }
+    }
+
+    std::mutex _mu;
+    std::condition_variable _cond;
+    std::deque<std::function<void()>> _queue;
+    bool _stopping = false;
+    std::vector<std::thread> _threads;
+};
+
+// defaultExecutor returns the process-wide pool, with one thread per CPU,
+// that resumes coroutines unless another executor is given.
+inline Executor& defaultExecutor() {
+    static ThreadPool pool;
+    return pool;
+}
+
+}
+}
+
+#endif // GOINCPP_RUNTIME_EXECUTOR_HPP
@@ -0,0 +1,206 @@
+// Copyright 2024 The Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef GOINCPP_RUNTIME_PARK_HPP
+#define GOINCPP_RUNTIME_PARK_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+#if defined(__linux__)
+#include <climits>
+#include <ctime>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#else
+#include <mutex>
+#include <condition_variable>
+#endif
+
+namespace goincpp {
+namespace runtime {
+
+// procyield executes cycles pause instructions, telling the CPU we are
+// spinning so it can yield resources to a sibling hyper-thread.
+inline void procyield(uint32_t cycles) {
+    for (uint32_t i = 0; i < cycles; i++) {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__)
+        asm volatile("yield" ::: "memory");
+#else
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+#endif
+    }
+}
+
+// osyield gives up the rest of the time slice.
+inline void osyield() {
+    std::this_thread::yield();
+}
+
+// ncpu is the number of logical CPUs, used to decide whether spinning
+// can ever pay off.
+inline unsigned ncpu() {
+    static const unsigned n = std::thread::hardware_concurrency();
+    return n;
+}
+
+#if defined(__linux__)
+
+// futexsleep atomically checks that *addr == val and sleeps until woken
+// by futexwakeup, for at most ns nanoseconds if ns >= 0. Spurious wake-ups
+// are possible; callers re-check their condition.
+inline void futexsleep(std::atomic<uint32_t>* addr, uint32_t val, int64_t ns = -1) {
+    struct timespec ts;
+    struct timespec* tsp = nullptr;
+    if (ns >= 0) {
+        ts.tv_sec = static_cast<time_t>(ns / 1000000000);
+        ts.tv_nsec = static_cast<long>(ns % 1000000000);
+        tsp = &ts;
+    }
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAIT_PRIVATE, val, tsp, nullptr, 0);
+}
+
+// futexwakeup wakes up to cnt threads sleeping on addr.
+inline void futexwakeup(std::atomic<uint32_t>* addr, int cnt = 1) {
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAKE_PRIVATE, cnt, nullptr, nullptr, 0);
+}
+
+// Parker blocks one thread until another one unparks it. unpark leaves a
+// permit if the thread is not parked yet, so the wake-up is never lost.
+//
+// park first spins for a short while, since on a multi-core machine the
+// counterpart of a channel operation often answers within a few hundred
+// nanoseconds, and only then sleeps on a futex. An unpark wakes the one
+// parked thread directly; no mutex is involved on either side.
+class Parker {
+public:
+    // park blocks until the permit is available and consumes it.
+    void park() {
+        if (spin()) {
+            return;
+        }
+        // empty -> parked, or notified -> empty.
+        if (_state.fetch_sub(1, std::memory_order_acquire) == notified) {
+            return;
+        }
+        for (;;) {
+            futexsleep(&_state, parked);
+            uint32_t expected = notified;
+            if (_state.compare_exchange_strong(expected, empty, std::memory_order_acquire)) {
+                return;
+            }
+        }
+    }
+
+    // parkUntil is park with a deadline. It returns false if the deadline
+    // passed without the permit becoming available.
+    template <typename Clock, typename Duration>
+    bool parkUntil(const std::chrono::time_point<Clock, Duration>& deadline) {
+        if (spin()) {
+            return true;
+        }
+        if (_state.fetch_sub(1, std::memory_order_acquire) == notified) {
+            return true;
+        }
+        for (;;) {
+            auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - Clock::now()).count();
+            if (ns > 0) {
+                futexsleep(&_state, parked, ns);
+            }
+            uint32_t expected = notified;
+            if (_state.compare_exchange_strong(expected, empty, std::memory_order_acquire)) {
+                return true;
+            }
+            if (ns <= 0) {
+                // parked -> empty, unless an unpark raced with the timeout.
+                expected = parked;
+                if (_state.compare_exchange_strong(expected, empty, std::memory_order_acquire)) {
+                    return false;
+                }
+            }
+        }
+    }
+
+    // unpark makes the permit available, waking the parked thread if any.
+    // The parked thread may return and destroy the Parker before
+    // futexwakeup runs; waking an address nobody sleeps on is harmless.
+    void unpark() {
+        if (_state.exchange(notified, std::memory_order_release) == parked) {
+            futexwakeup(&_state);
+        }
+    }
+
+private:
+    static constexpr uint32_t empty = 0;
+    static constexpr uint32_t notified = 1;
+    static constexpr uint32_t parked = UINT32_MAX; // empty - 1
+
+    static constexpr int spinIterations = 100;
+    static constexpr uint32_t spinCycles = 30;
+
+    // spin polls for the permit for a few microseconds, if there is
+    // another CPU that could deliver it meanwhile.
+    bool spin() {
+        if (ncpu() > 1) {
+            for (int i = 0; i < spinIterations; i++) {
+                if (_state.load(std::memory_order_relaxed) == notified) {
+                    uint32_t expected = notified;
+                    if (_state.compare_exchange_strong(expected, empty, std::memory_order_acquire)) {
+                        return true;
+                    }
+                }
+                procyield(spinCycles);
+            }
+        }
+        return false;
+    }
+
+    std::atomic<uint32_t> _state{empty};
+};
+
+#else // __linux__
+
+// Parker blocks one thread until another one unparks it. unpark leaves a
+// permit if the thread is not parked yet, so the wake-up is never lost.
+class Parker {
+public:
+    void park() {
+        std::unique_lock<std::mutex> lock(_mu);
+        _cond.wait(lock, [this]() { return _notified; });
+        _notified = false;
+    }
+
+    template <typename Clock, typename Duration>
+    bool parkUntil(const std::chrono::time_point<Clock, Duration>& deadline) {
+        std::unique_lock<std::mutex> lock(_mu);
+        if (!_cond.wait_until(lock, deadline, [this]() { return _notified; })) {
+            return false;
+        }
+        _notified = false;
+        return true;
+    }
+
+    void unpark() {
+        std::lock_guard<std::mutex> lock(_mu);
+        _notified = true;
+        _cond.notify_one();
+    }
+
+private:
+    std::mutex _mu;
+    std::condition_variable _cond;
+    bool _notified = false;
+};
+
+#endif // __linux__
+
+}
+}
+
+#endif // GOINCPP_RUNTIME_PARK_HPP
@@ -0,0 +1,681 @@
+// Copyright 2024 The Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef GOINCPP_RUNTIME_PROC_HPP
+#define GOINCPP_RUNTIME_PROC_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#include "executor.hpp"
+#include "park.hpp"
+#include "rand.hpp"
+
+namespace goincpp {
+namespace runtime {
+
+class Sched;
+class Worker;
+
+// G is a goroutine: a function running on a stack of its own, multiplexed
+// with all other goroutines onto the worker threads of the scheduler. A
+// goroutine that blocks in a channel operation is switched out and its
+// worker runs something else; it is put back on a run queue when woken.
+//
+// G objects with a null stack are plain runnables posted through the
+// Executor interface; they run to completion on the worker's own stack.
+struct G {
+    enum class Op { none, park, parkTimed, yield, exit };
+
+    std::function<void()> fn;
+    Sched* sched = nullptr;
+    ucontext_t context;
+    void* stack = nullptr;
+    std::size_t stackSize = 0;
+    // schedlink links the G into the global run queue or the free list.
+    G* schedlink = nullptr;
+
+    // parkState is the park/unpark permit of the goroutine, see gopark.
+    std::atomic<uint32_t> parkState{0};
+    // op is what the goroutine asks its worker to do once switched out.
+    Op op = Op::none;
+    std::chrono::steady_clock::time_point deadline;
+    // The timer of a timed park, guarded by the scheduler's timer lock.
+    bool timerArmed = false;
+    std::multimap<std::chrono::steady_clock::time_point, G*>::iterator timer;
+};
+
+// RunQueue is the local run queue of a worker: a fixed-size ring that only
+// the owning worker appends to, while the owner and thieves take from the
+// head with a CAS. When it is full, half of it moves to the global queue.
+class RunQueue {
+public:
+    static constexpr uint32_t size = 256;
+
+    // put appends g. Owner only. It returns false if the ring is full.
+    bool put(G* g) {
+        auto h = _head.load(std::memory_order_acquire);
+        auto t = _tail.load(std::memory_order_relaxed);
+        if (t - h >= size) {
+            return false;
+        }
+        _buf[t % size].store(g, std::memory_order_relaxed);
+        _tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // get takes the oldest G. Owner only.
+    G* get() {
+        auto h = _head.load(std::memory_order_acquire);
+        for (;;) {
+            auto t = _tail.load(std::memory_order_relaxed);
+            if (t == h) {
+                return nullptr;
+            }
+            G* g = _buf[h % size].load(std::memory_order_relaxed);
+            if (_head.compare_exchange_weak(h, h + 1, std::memory_order_acq_rel)) {
+                return g;
+            }
+        }
+    }
+
+    // grab takes half of the queued Gs, at most max, into batch with a
+    // single CAS. Any thread may call it.
+    uint32_t grab(G** batch, uint32_t max) {
+        for (;;) {
+            auto h = _head.load(std::memory_order_acquire);
+            auto t = _tail.load(std::memory_order_acquire);
+            uint32_t n = t - h;
+            n = n - n / 2;
+            if (n > max) {
+                n = max;
+            }
+            if (n == 0) {
+                return 0;
+            }
+            if (n > size / 2) {
+                continue; // h and t are inconsistent, read them again
+            }
+            for (uint32_t i = 0; i < n; i++) {
+                batch[i] = _buf[(h + i) % size].load(std::memory_order_relaxed);
+            }
+            if (_head.compare_exchange_weak(h, h + n, std::memory_order_acq_rel)) {
+                return n;
+            }
+        }
+    }
+
+    bool empty() const {
+        return _head.load(std::memory_order_acquire) == _tail.load(std::memory_order_acquire);
+    }
+
+private:
+    alignas(cacheLinePadSize) std::atomic<uint32_t> _head{0};
+    alignas(cacheLinePadSize) std::atomic<uint32_t> _tail{0};
+    std::atomic<G*> _buf[size];
+};
+
+// Worker is an OS thread running goroutines: it takes them from its own
+// run queue, from the global queue, or steals them from other workers, and
+// sleeps when there is nothing to run at all.
+class Worker {
+public:
+    Worker(Sched& sched, unsigned id) : _sched(sched), _id(id) {}
+
+    G* curg() const { return _curg; }
+
+private:
+    friend class Sched;
+    friend void gswitch(G* g);
+
+    void run();
+    G* findRunnable();
+    G* steal();
+    void execute(G* g);
+    void runqput(G* g);
+
+    Sched& _sched;
+    unsigned _id;
+    RunQueue _runq;
+    Parker _parker;
+    // _g0 is the context of the worker's own stack, on which the scheduling
+    // loop runs between goroutines.
+    ucontext_t _g0;
+    G* _curg = nullptr;
+    uint32_t _schedtick = 0;
+};
+
+inline thread_local Worker* currentWorker = nullptr;
+
+// getm returns the worker the caller runs on, or nullptr outside of the
+// scheduler. A goroutine may move to another worker at every park, so the
+// thread-local is re-read on every call instead of being cached.
+__attribute__((noinline)) inline Worker* getm() {
+    asm volatile("" ::: "memory");
+    return currentWorker;
+}
+
+// getg returns the goroutine the caller runs on, or nullptr on a plain
+// thread.
+inline G* getg() {
+    Worker* m = getm();
+    return m ? m->curg() : nullptr;
+}
+
+// Sched is the M:N scheduler behind go. It owns a fixed set of workers,
+// GOMAXPROCS of them if that environment variable is set and one per CPU
+// otherwise, a global run queue for Gs readied outside of the workers and
+// for overflowing local queues, and a timer thread for timed parks.
+//
+// The scheduler lives for the whole process; its threads are never joined.
+class Sched : public Executor {
+public:
+    explicit Sched(unsigned nworkers) {
+        if (nworkers == 0) {
+            nworkers = 1;
+        }
+        for (unsigned i = 0; i < nworkers; i++) {
+            _workers.push_back(std::make_unique<Worker>(*this, i));
+        }
+        for (auto& w : _workers) {
+            std::thread([w = w.get()]() { w->run(); }).detach();
+        }
+        std::thread([this]() { timerproc(); }).detach();
+    }
+
+    Sched(const Sched&) = delete;
+    Sched& operator=(const Sched&) = delete;
+
+    // go starts fn as a new goroutine.
+    void go(std::function<void()> fn) {
+        G* g = gfget();
+        makegcontext(g);
+        g->fn = std::move(fn);
+        g->sched = this;
+        g->op = G::Op::none;
+        g->parkState.store(0, std::memory_order_relaxed);
+        ready(g);
+    }
+
+    // post runs fn on a worker, on the worker's own stack.
+    void post(std::function<void()> fn) override {
+        G* g = new G;
+        g->fn = std::move(fn);
+        g->sched = this;
+        ready(g);
+    }
+
+    // ready makes g runnable: on the local queue of the calling worker,
+    // so that a goroutine woken by another one runs on the same CPU, or on
+    // the global queue when called from outside the scheduler.
+    void ready(G* g) {
+        Worker* m = getm();
+        if (m && &m->_sched == this) {
+            m->runqput(g);
+        } else {
+            globrunqput(g, g, 1);
+        }
+        wakep();
+    }
+
+    unsigned nworkers() const { return static_cast<unsigned>(_workers.size()); }
+
+private:
+    friend class Worker;
+    friend bool goparkUntil(G* g, std::chrono::steady_clock::time_point deadline);
+
+    static constexpr std::size_t stackSize = 256 * 1024;
+    static constexpr int maxFreeGs = 1024;
+
+    static void gentry();
+
+    // makegcontext points the context of g at gentry on its own stack. It
+    // is kept out of line so that the frame calling getcontext, which the
+    // compiler treats like setjmp, holds no locals of go.
+    [[gnu::noinline]] static void makegcontext(G* g) {
+        getcontext(&g->context);
+        g->context.uc_stack.ss_sp = g->stack;
+        g->context.uc_stack.ss_size = g->stackSize;
+        g->context.uc_link = nullptr;
+        makecontext(&g->context, &Sched::gentry, 0);
+    }
+
+    // gfget returns a G with a stack, reusing the one of a finished
+    // goroutine if possible. Stacks are mapped lazily with a guard page
+    // below them, so an overflow faults instead of corrupting memory.
+    G* gfget() {
+        do {
+            std::lock_guard<std::mutex> lock(_gfreeMu);
+            if (G* g = _gfree) {
+                _gfree = g->schedlink;
+                _ngfree--;
+                return g;
+            }
+        } while(0);
+        auto pagesize = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+        void* mem = mmap(nullptr, stackSize + pagesize, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+        if (mem == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+        mprotect(mem, pagesize, PROT_NONE);
+        G* g = new G;
+        g->stack = static_cast<char*>(mem) + pagesize;
+        g->stackSize = stackSize;
+        return g;
+    }
+
+    void gfput(G* g) {
+        do {
+            std::lock_guard<std::mutex> lock(_gfreeMu);
+            if (_ngfree < maxFreeGs) {
+                g->schedlink = _gfree;
+                _gfree = g;
+                _ngfree++;
+                return;
+            }
+        } while(0);
+        auto pagesize = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+        munmap(static_cast<char*>(g->stack) - pagesize, g->stackSize + pagesize);
+        delete g;
+    }
+
+    // globrunqput appends the n Gs linked from first to last.
+    void globrunqput(G* first, G* last, uint32_t n) {
+        std::lock_guard<std::mutex> lock(_globMu);
+        last->schedlink = nullptr;
+        if (_globTail) {
+            _globTail->schedlink = first;
+        } else {
+            _globHead = first;
+        }
+        _globTail = last;
+        _globSize.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    // globrunqget takes a fair share of the global queue, returning the
+    // first G and moving the rest to m's local queue. max limits the share,
+    // 0 means no limit beyond half a local queue.
+    G* globrunqget(Worker* m, uint32_t max) {
+        if (_globSize.load(std::memory_order_relaxed) == 0) {
+            return nullptr;
+        }
+        std::lock_guard<std::mutex> lock(_globMu);
+        uint32_t size = _globSize.load(std::memory_order_relaxed);
+        if (size == 0) {
+            return nullptr;
+        }
+        uint32_t n = size / nworkers() + 1;
+        if (n > size) {
+            n = size;
+        }
+        if (max > 0 && n > max) {
+            n = max;
+        }
+        if (n > RunQueue::size / 2) {
+            n = RunQueue::size / 2;
+        }
+        _globSize.fetch_sub(n, std::memory_order_relaxed);
+        G* g = _globHead;
+        _globHead = g->schedlink;
+        for (uint32_t i = 1; i < n; i++) {
+            G* next = _globHead;
+            _globHead = next->schedlink;
+            m->_runq.put(next);
+        }
+        if (!_globHead) {
+            _globTail = nullptr;
+        }
+        return g;
+    }
+
+    // wakep wakes an idle worker, if any, to pick up newly readied work.
+    // The fence pairs with the one in pidleput: either the idle worker sees
+    // the work when it re-checks the queues, or we see it idle.
+    void wakep() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (_nidle.load(std::memory_order_relaxed) == 0) {
+            return;
+        }
+        Worker* w = nullptr;
+        do {
+            std::lock_guard<std::mutex> lock(_idleMu);
+            if (_idle.empty()) {
+                return;
+            }
+            w = _idle.back();
+            _idle.pop_back();
+            _nidle.fetch_sub(1, std::memory_order_relaxed);
+        } while(0);
+        w->_parker.unpark();
+    }
+
+    void pidleput(Worker* w) {
+        std::lock_guard<std::mutex> lock(_idleMu);
+        _idle.push_back(w);
+        _nidle.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+
+    // pidleremove takes w off the idle list unless a waker did already, in
+    // which case w's parker holds a permit that makes its next park return
+    // at once.
+    void pidleremove(Worker* w) {
+        std::lock_guard<std::mutex> lock(_idleMu);
+        for (auto it = _idle.begin(); it != _idle.end(); ++it) {
+            if (*it == w) {
+                _idle.erase(it);
+                _nidle.fetch_sub(1, std::memory_order_relaxed);
+                return;
+            }
+        }
+    }
+
+    bool hasWork() const {
+        if (_globSize.load(std::memory_order_relaxed) > 0) {
+            return true;
+        }
+        for (auto& w : _workers) {
+            if (!w->_runq.empty()) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // parkTimed finishes the timed park of g on its worker's stack: g is
+    // only marked parked together with arming its timer, under the timer
+    // lock, so the timer can neither fire before g is parked nor outlive g.
+    void parkTimed(Worker* m, G* g) {
+        std::lock_guard<std::mutex> lock(_timersMu);
+        uint32_t expected = 0;
+        if (!g->parkState.compare_exchange_strong(expected, 2, std::memory_order_acq_rel)) {
+            m->runqput(g); // unparked meanwhile
+            return;
+        }
+        g->timer = _timers.emplace(g->deadline, g);
+        g->timerArmed = true;
+        if (g->timer == _timers.begin()) {
+            _timersCond.notify_one();
+        }
+    }
+
+    void disarm(G* g) {
+        std::lock_guard<std::mutex> lock(_timersMu);
+        if (g->timerArmed) {
+            _timers.erase(g->timer);
+            g->timerArmed = false;
+        }
+    }
+
+    // timerproc wakes goroutines whose timed park expired.
+    void timerproc() {
+        std::unique_lock<std::mutex> lock(_timersMu);
+        for (;;) {
+            if (_timers.empty()) {
+                _timersCond.wait(lock);
+                continue;
+            }
+            auto it = _timers.begin();
+            if (it->first > std::chrono::steady_clock::now()) {
+                _timersCond.wait_until(lock, it->first);
+                continue;
+            }
+            G* g = it->second;
+            _timers.erase(it);
+            g->timerArmed = false;
+            uint32_t expected = 2; // parked -> empty, unless unparked already
+            if (g->parkState.compare_exchange_strong(expected, 0, std::memory_order_acq_rel)) {
+                ready(g);
+            }
+        }
+    }
+
+    std::vector<std::unique_ptr<Worker>> _workers;
+
+    std::mutex _globMu;
+    G* _globHead = nullptr;
+    G* _globTail = nullptr;
+    std::atomic<uint32_t> _globSize{0};
+
+    std::mutex _idleMu;
+    std::vector<Worker*> _idle;
+    std::atomic<uint32_t> _nidle{0};
+
+    std::mutex _gfreeMu;
+    G* _gfree = nullptr;
+    int _ngfree = 0;
+
+    std::mutex _timersMu;
+    std::condition_variable _timersCond;
+    std::multimap<std::chrono::steady_clock::time_point, G*> _timers;
+};
+
+// gswitch switches from goroutine g back to the scheduling loop of the
+// worker it currently runs on, which then carries out g->op.
+inline void gswitch(G* g) {
+    Worker* m = getm();
+    swapcontext(&g->context, &m->_g0);
+}
+
+inline void Sched::gentry() {
+    G* g = getg();
+    try {
+        g->fn();
+    } catch (...) {
+        // Like a panic in Go, an exception escaping a goroutine is fatal.
+        std::terminate();
+    }
+    g->fn = nullptr;
+    g->op = G::Op::exit;
+    gswitch(g);
+}
+
+inline void Worker::run() {
+    currentWorker = this;
+    for (;;) {
+        execute(findRunnable());
+    }
+}
+
+inline G* Worker::findRunnable() {
+    for (;;) {
+        // Check the global queue once in a while so that two goroutines
+        // waking each other up on a local queue cannot starve it.
+        if (++_schedtick % 61 == 0) {
+            if (G* g = _sched.globrunqget(this, 1)) {
+                return g;
+            }
+        }
+        if (G* g = _runq.get()) {
+            return g;
+        }
+        if (G* g = _sched.globrunqget(this, 0)) {
+            return g;
+        }
+        if (G* g = steal()) {
+            return g;
+        }
+        _sched.pidleput(this);
+        if (_sched.hasWork()) {
+            _sched.pidleremove(this);
+            continue;
+        }
+        _parker.park();
+    }
+}
+
+// steal takes half of the local queue of another worker, visiting the
+// workers in a random order.
+inline G* Worker::steal() {
+    auto n = _sched.nworkers();
+    if (n < 2) {
+        return nullptr;
+    }
+    G* batch[RunQueue::size / 2];
+    for (int round = 0; round < 4; round++) {
+        auto start = cheaprandn(n);
+        for (unsigned i = 0; i < n; i++) {
+            Worker* victim = _sched._workers[(start + i) % n].get();
+            if (victim == this) {
+                continue;
+            }
+            auto k = victim->_runq.grab(batch, RunQueue::size / 2);
+            if (k > 0) {
+                for (uint32_t j = 0; j + 1 < k; j++) {
+                    _runq.put(batch[j]);
+                }
+                return batch[k - 1];
+            }
+        }
+    }
+    return nullptr;
+}
+
+inline void Worker::runqput(G* g) {
+    if (_runq.put(g)) {
+        return;
+    }
+    // Full: move half of the local queue, plus g, to the global queue.
+    G* batch[RunQueue::size / 2 + 1];
+    auto n = _runq.grab(batch, RunQueue::size / 2);
+    batch[n++] = g;
+    for (uint32_t i = 0; i + 1 < n; i++) {
+        batch[i]->schedlink = batch[i + 1];
+    }
+    _sched.globrunqput(batch[0], batch[n - 1], n);
+}
+
+inline void Worker::execute(G* g) {
+    if (!g->stack) {
+        g->fn();
+        delete g;
+        return;
+    }
+    _curg = g;
+    swapcontext(&_g0, &g->context);
+    _curg = nullptr;
+
+    switch (g->op) {
+    case G::Op::exit:
+        _sched.gfput(g);
+        break;
+    case G::Op::yield:
+        _sched.globrunqput(g, g, 1);
+        break;
+    case G::Op::park: {
+        // empty -> parked, unless an unpark came in before we got here.
+        uint32_t expected = 0;
+        if (!g->parkState.compare_exchange_strong(expected, 2, std::memory_order_acq_rel)) {
+            runqput(g);
+        }
+        break;
+    }
+    case G::Op::parkTimed:
+        _sched.parkTimed(this, g);
+        break;
+    case G::Op::none:
+        break;
+    }
+}
+
+// scheduler returns the process-wide scheduler. It is also an Executor, so
+// coroutines can be resumed on the same workers as goroutines.
+inline Sched& scheduler() {
+    static Sched* sched = []() {
+        unsigned n = ncpu();
+        if (const char* s = std::getenv("GOMAXPROCS")) {
+            if (int v = std::atoi(s); v > 0) {
+                n = static_cast<unsigned>(v);
+            }
+        }
+        return new Sched(n);
+    }();
+    return *sched;
+}
+
+// go runs fn in a new goroutine.
+//
+//	runtime::go([ch]() {
+//	    ch << compute();
+//	});
+//
+// Blocking channel operations and selects inside fn park the goroutine and
+// let its worker run others. Other blocking calls, such as sleeping or
+// waiting on a mutex, block the worker thread.
+inline void go(std::function<void()> fn) {
+    scheduler().go(std::move(fn));
+}
+
+// gosched yields the worker to other goroutines; outside of a goroutine it
+// yields the thread.
+inline void gosched() {
+    G* g = getg();
+    if (!g) {
+        osyield();
+        return;
+    }
+    g->op = G::Op::yield;
+    gswitch(g);
+}
+
+// gopark blocks goroutine g until goready is called for it. Like Parker,
+// goready leaves a permit if g is not parked yet.
+//
+// The goroutine only switches away; its worker marks it parked afterwards,
+// once g no longer runs on its stack. An unpark that finds g not yet marked
+// parked leaves the permit, which the worker then notices.
+inline void gopark(G* g) {
+    uint32_t expected = 1; // notified -> empty
+    if (g->parkState.compare_exchange_strong(expected, 0, std::memory_order_acquire)) {
+        return;
+    }
+    g->op = G::Op::park;
+    gswitch(g);
+    g->parkState.exchange(0, std::memory_order_acquire);
+}
+
+// goparkUntil is gopark with a deadline. It returns false on timeout.
+inline bool goparkUntil(G* g, std::chrono::steady_clock::time_point deadline) {
+    uint32_t expected = 1;
+    if (g->parkState.compare_exchange_strong(expected, 0, std::memory_order_acquire)) {
+        return true;
+    }
+    if (deadline <= std::chrono::steady_clock::now()) {
+        return false;
+    }
+    g->deadline = deadline;
+    g->op = G::Op::parkTimed;
+    gswitch(g);
+    g->sched->disarm(g);
+    expected = 1;
+    return g->parkState.compare_exchange_strong(expected, 0, std::memory_order_acquire);
+}
+
+// goready unparks g, rescheduling it if it is parked.
+inline void goready(G* g) {
+    if (g->parkState.exchange(1, std::memory_order_acq_rel) == 2) {
+        g->sched->ready(g);
+    }
+}
+
+}
+}
+
+#endif // GOINCPP_RUNTIME_PROC_HPP
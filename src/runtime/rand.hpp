@@ -0,0 +1,33 @@
+// Copyright 2024 The Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef GOINCPP_RUNTIME_RAND_HPP
+#define GOINCPP_RUNTIME_RAND_HPP
+
+#include <chrono>
+#include <cstdint>
+
+namespace goincpp {
+namespace runtime {
+
+// cheaprand is a non-cryptographic per-thread random generator (wyrand).
+// It is used where the runtime needs cheap fairness, e.g. by select.
+inline uint32_t cheaprand() {
+    thread_local uint64_t state =
+        static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count()) ^
+        reinterpret_cast<uintptr_t>(&state);
+    state += 0xa0761d6478bd642full;
+    __uint128_t t = static_cast<__uint128_t>(state) * (state ^ 0xe7037ed1a0b428dbull);
+    return static_cast<uint32_t>((t >> 64) ^ t);
+}
+
+// cheaprandn returns a random number in [0, n).
+inline uint32_t cheaprandn(uint32_t n) {
+    return static_cast<uint32_t>((static_cast<uint64_t>(cheaprand()) * n) >> 32);
+}
+
+}
+}
+
+#endif // GOINCPP_RUNTIME_RAND_HPP
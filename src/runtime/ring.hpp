@@ -0,0 +1,330 @@
+// Copyright 2024 The Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef GOINCPP_RUNTIME_RING_HPP
+#define GOINCPP_RUNTIME_RING_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace goincpp {
+namespace runtime {
+
+// cacheLinePadSize is the size used to keep independently written
+// fields on separate cache lines.
+constexpr std::size_t cacheLinePadSize = 64;
+
+// Mpmc, Mpsc and Spsc are the concurrency policies of RingBuffer and
+// Channel. They state how many threads may send and receive at the same
+// time, and pick the cheapest implementation that is correct for it.
+// Breaking the promise of a policy is undefined behavior.
+struct Mpmc {}; // any number of senders and receivers
+struct Mpsc {}; // any number of senders, a single receiver
+struct Spsc {}; // a single sender and a single receiver
+
+// RingBuffer is a fixed-capacity, lock-free, multi-producer multi-consumer
+// queue. Each slot carries a turn counter telling producers and consumers
+// whose turn it is: the n-th lap over the ring writes a slot on turn 2n and
+// reads it on turn 2n+1. A push or pop thus costs one CAS on the shared
+// index and never takes a lock. The send and receive indices live on
+// separate cache lines so producers and consumers do not invalidate each
+// other's lines.
+//
+// With the Mpsc policy the single consumer owns the receive index: a pop
+// only checks the slot's turn and advances the index with a plain store.
+template <typename T, std::size_t Capacity, typename Policy = Mpmc>
+class RingBuffer {
+    static_assert(Capacity > 0, "RingBuffer capacity must be positive");
+
+public:
+    RingBuffer() = default;
+
+    RingBuffer(const RingBuffer&) = delete;
+    RingBuffer& operator=(const RingBuffer&) = delete;
+
+    ~RingBuffer() {
+        auto recvx = _recvx.load(std::memory_order_relaxed);
+        auto sendx = _sendx.load(std::memory_order_relaxed);
+        for (; recvx != sendx; recvx++) {
+            _slots[recvx % Capacity].elem()->~T();
+        }
+    }
+
+    // tryPush appends value unless the buffer is full.
+    template <typename U>
+    bool tryPush(U&& value) {
+        return tryEmplace(std::forward<U>(value));
+    }
+
+    // tryEmplace constructs an element in place from args unless the
+    // buffer is full. args are left untouched when it fails.
+    template <typename... Args>
+    bool tryEmplace(Args&&... args) {
+        auto pos = _sendx.load(std::memory_order_relaxed);
+        for (;;) {
+            Slot& slot = _slots[pos % Capacity];
+            if (slot.turn.load(std::memory_order_acquire) == turn(pos)) {
+                if (_sendx.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    new (slot.storage) T(std::forward<Args>(args)...);
+                    slot.turn.store(turn(pos) + 1, std::memory_order_release);
+                    return true;
+                }
+            } else {
+                auto prev = pos;
+                pos = _sendx.load(std::memory_order_relaxed);
+                if (pos == prev) {
+                    return false; // full
+                }
+            }
+        }
+    }
+
+    // tryPop moves the oldest element into value unless the buffer is empty.
+    bool tryPop(T& value) {
+        auto pos = _recvx.load(std::memory_order_relaxed);
+        if constexpr (std::is_same_v<Policy, Mpsc>) {
+            Slot& slot = _slots[pos % Capacity];
+            if (slot.turn.load(std::memory_order_acquire) != turn(pos) + 1) {
+                return false; // empty
+            }
+            take(slot, pos, value);
+            _recvx.store(pos + 1, std::memory_order_relaxed);
+            return true;
+        }
+        for (;;) {
+            Slot& slot = _slots[pos % Capacity];
+            if (slot.turn.load(std::memory_order_acquire) == turn(pos) + 1) {
+                if (_recvx.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    take(slot, pos, value);
+                    return true;
+                }
+            } else {
+                auto prev = pos;
+                pos = _recvx.load(std::memory_order_relaxed);
+                if (pos == prev) {
+                    return false; // empty
+                }
+            }
+        }
+    }
+
+    // tryPushN appends the longest prefix of values that fits. The slots for
+    // the whole run are claimed with a single CAS. It returns the number of
+    // elements appended.
+    std::size_t tryPushN(const T* values, std::size_t n) {
+        auto pos = _sendx.load(std::memory_order_relaxed);
+        for (;;) {
+            std::size_t k = 0;
+            while (k < n && _slots[(pos + k) % Capacity].turn.load(std::memory_order_acquire) == turn(pos + k)) {
+                k++;
+            }
+            if (k == 0) {
+                auto prev = pos;
+                pos = _sendx.load(std::memory_order_relaxed);
+                if (pos == prev) {
+                    return 0; // full
+                }
+            } else if (_sendx.compare_exchange_weak(pos, pos + k, std::memory_order_relaxed)) {
+                for (std::size_t i = 0; i < k; i++) {
+                    Slot& slot = _slots[(pos + i) % Capacity];
+                    new (slot.storage) T(values[i]);
+                    slot.turn.store(turn(pos + i) + 1, std::memory_order_release);
+                }
+                return k;
+            }
+        }
+    }
+
+    // tryPopN moves up to n of the oldest elements into values, claiming
+    // them with a single CAS. It returns the number of elements moved.
+    std::size_t tryPopN(T* values, std::size_t n) {
+        auto pos = _recvx.load(std::memory_order_relaxed);
+        for (;;) {
+            std::size_t k = 0;
+            while (k < n && _slots[(pos + k) % Capacity].turn.load(std::memory_order_acquire) == turn(pos + k) + 1) {
+                k++;
+            }
+            if constexpr (std::is_same_v<Policy, Mpsc>) {
+                for (std::size_t i = 0; i < k; i++) {
+                    take(_slots[(pos + i) % Capacity], pos + i, values[i]);
+                }
+                _recvx.store(pos + k, std::memory_order_relaxed);
+                return k;
+            }
+            if (k == 0) {
+                auto prev = pos;
+                pos = _recvx.load(std::memory_order_relaxed);
+                if (pos == prev) {
+                    return 0; // empty
+                }
+            } else if (_recvx.compare_exchange_weak(pos, pos + k, std::memory_order_relaxed)) {
+                for (std::size_t i = 0; i < k; i++) {
+                    take(_slots[(pos + i) % Capacity], pos + i, values[i]);
+                }
+                return k;
+            }
+        }
+    }
+
+    // size returns a snapshot of the number of queued elements.
+    std::size_t size() const {
+        auto recvx = _recvx.load(std::memory_order_relaxed);
+        auto sendx = _sendx.load(std::memory_order_relaxed);
+        return sendx > recvx ? sendx - recvx : 0;
+    }
+
+    static constexpr std::size_t capacity() { return Capacity; }
+
+private:
+    static constexpr std::size_t turn(std::size_t pos) { return pos / Capacity * 2; }
+
+    struct Slot {
+        std::atomic<std::size_t> turn{0};
+        alignas(T) unsigned char storage[sizeof(T)];
+
+        T* elem() { return std::launder(reinterpret_cast<T*>(storage)); }
+    };
+
+    // take moves the element of a claimed slot into value and hands the
+    // slot to the producers of the next lap.
+    static void take(Slot& slot, std::size_t pos, T& value) {
+        T* elem = slot.elem();
+        value = std::move(*elem);
+        elem->~T();
+        slot.turn.store(turn(pos) + 2, std::memory_order_release);
+    }
+
+    alignas(cacheLinePadSize) std::atomic<std::size_t> _sendx{0};
+    alignas(cacheLinePadSize) std::atomic<std::size_t> _recvx{0};
+    alignas(cacheLinePadSize) Slot _slots[Capacity];
+};
+
+// RingBuffer with the Spsc policy is a Lamport queue: the producer owns the
+// send index and the consumer owns the receive index, so each side only
+// loads the other's index and publishes its own with a release store. No
+// operation is a read-modify-write. Each side also caches the last index it
+// saw of the other one and only reloads it when the ring looks full (or
+// empty), which keeps the other side's cache line from bouncing.
+template <typename T, std::size_t Capacity>
+class RingBuffer<T, Capacity, Spsc> {
+    static_assert(Capacity > 0, "RingBuffer capacity must be positive");
+
+public:
+    RingBuffer() = default;
+
+    RingBuffer(const RingBuffer&) = delete;
+    RingBuffer& operator=(const RingBuffer&) = delete;
+
+    ~RingBuffer() {
+        auto recvx = _recvx.load(std::memory_order_relaxed);
+        auto sendx = _sendx.load(std::memory_order_relaxed);
+        for (; recvx != sendx; recvx++) {
+            elem(recvx)->~T();
+        }
+    }
+
+    template <typename U>
+    bool tryPush(U&& value) {
+        return tryEmplace(std::forward<U>(value));
+    }
+
+    template <typename... Args>
+    bool tryEmplace(Args&&... args) {
+        auto pos = _sendx.load(std::memory_order_relaxed);
+        if (space(pos) == 0) {
+            return false;
+        }
+        new (_slots[pos % Capacity].storage) T(std::forward<Args>(args)...);
+        _sendx.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool tryPop(T& value) {
+        auto pos = _recvx.load(std::memory_order_relaxed);
+        if (filled(pos) == 0) {
+            return false;
+        }
+        T* e = elem(pos);
+        value = std::move(*e);
+        e->~T();
+        _recvx.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    std::size_t tryPushN(const T* values, std::size_t n) {
+        auto pos = _sendx.load(std::memory_order_relaxed);
+        auto k = std::min(n, space(pos, n));
+        for (std::size_t i = 0; i < k; i++) {
+            new (_slots[(pos + i) % Capacity].storage) T(values[i]);
+        }
+        if (k > 0) {
+            _sendx.store(pos + k, std::memory_order_release);
+        }
+        return k;
+    }
+
+    std::size_t tryPopN(T* values, std::size_t n) {
+        auto pos = _recvx.load(std::memory_order_relaxed);
+        auto k = std::min(n, filled(pos, n));
+        for (std::size_t i = 0; i < k; i++) {
+            T* e = elem(pos + i);
+            values[i] = std::move(*e);
+            e->~T();
+        }
+        if (k > 0) {
+            _recvx.store(pos + k, std::memory_order_release);
+        }
+        return k;
+    }
+
+    std::size_t size() const {
+        auto recvx = _recvx.load(std::memory_order_relaxed);
+        auto sendx = _sendx.load(std::memory_order_relaxed);
+        return sendx > recvx ? sendx - recvx : 0;
+    }
+
+    static constexpr std::size_t capacity() { return Capacity; }
+
+private:
+    struct Slot {
+        alignas(T) unsigned char storage[sizeof(T)];
+    };
+
+    T* elem(std::size_t pos) { return std::launder(reinterpret_cast<T*>(_slots[pos % Capacity].storage)); }
+
+    // space returns the number of empty slots from the producer's point of
+    // view, reloading the receive index only if fewer than want are known.
+    std::size_t space(std::size_t sendx, std::size_t want = 1) {
+        if (Capacity - (sendx - _recvxCache) < want) {
+            _recvxCache = _recvx.load(std::memory_order_acquire);
+        }
+        return Capacity - (sendx - _recvxCache);
+    }
+
+    // filled returns the number of filled slots from the consumer's point of
+    // view, reloading the send index only if fewer than want are known.
+    std::size_t filled(std::size_t recvx, std::size_t want = 1) {
+        if (_sendxCache - recvx < want) {
+            _sendxCache = _sendx.load(std::memory_order_acquire);
+        }
+        return _sendxCache - recvx;
+    }
+
+    // The producer's line: its index and its view of the consumer's.
+    alignas(cacheLinePadSize) std::atomic<std::size_t> _sendx{0};
+    std::size_t _recvxCache = 0;
+    // The consumer's line.
+    alignas(cacheLinePadSize) std::atomic<std::size_t> _recvx{0};
+    std::size_t _sendxCache = 0;
+    alignas(cacheLinePadSize) Slot _slots[Capacity];
+};
+
+}
+}
+
+#endif // GOINCPP_RUNTIME_RING_HPP
@@ -0,0 +1,292 @@
+// Copyright 2024 The Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef GOINCPP_RUNTIME_SELECT_HPP
+#define GOINCPP_RUNTIME_SELECT_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+#include "chan.hpp"
+#include "rand.hpp"
+
+namespace goincpp {
+namespace runtime {
+
+// SelectCase describes one communication of a select statement: a send or
+// a receive on a channel of any element type, or the default case. Cases
+// are built with caseSend, caseRecv and caseDefault.
+class SelectCase {
+public:
+    enum class Kind { nil, recv, send, dflt };
+
+    SelectCase(Kind kind, ChannelBase* c, void* elem, bool* ok, bool movable = false)
+        : _kind(c == nullptr && kind != Kind::dflt ? Kind::nil : kind),
+          _c(c), _elem(elem), _ok(ok), _movable(movable) {}
+
+    SelectCase(const SelectCase&) = delete;
+    SelectCase& operator=(const SelectCase&) = delete;
+
+    Kind kind() const { return _kind; }
+
+private:
+    friend int selectgo(SelectCase** cases, uint16_t* order, int ncases);
+
+    // tryLocked attempts the communication without blocking; the caller
+    // holds the channel lock.
+    bool tryLocked(const Waiter* self, Waiter** wake) {
+        bool ok = false;
+        bool done = _kind == Kind::send ? _c->sendLocked(_elem, _movable, &ok, self, wake)
+                                        : _c->recvLocked(_elem, &ok, self, wake);
+        if (!done) {
+            return false;
+        }
+        if (_ok) {
+            *_ok = ok;
+        }
+        return true;
+    }
+
+    WaitQueue& queue() { return _kind == Kind::send ? _c->_sendq : _c->_recvq; }
+
+    void enqueue(Waiter* w, int index) {
+        _sg.waiter = w;
+        _sg.elem = _elem;
+        _sg.movable = _movable;
+        _sg.index = index;
+        queue().enqueue(&_sg);
+    }
+
+    void dequeue() { queue().remove(&_sg); }
+
+    void lock() { _c->_lock.lock(); }
+    void unlock() { _c->_lock.unlock(); }
+
+    Kind _kind;
+    ChannelBase* _c;
+    void* _elem;
+    bool* _ok;
+    bool _movable;
+    Sudog _sg;
+};
+
+// caseRecv receives from ch into value. ok, if given, is set to false when
+// the case fired because ch is closed and drained. A null ch never fires.
+template <typename T, int Capacity, typename Policy>
+SelectCase caseRecv(const std::shared_ptr<Channel<T, Capacity, Policy>>& ch, T& value, bool& ok) {
+    return SelectCase(SelectCase::Kind::recv, ch.get(), &value, &ok);
+}
+
+template <typename T, int Capacity, typename Policy>
+SelectCase caseRecv(const std::shared_ptr<Channel<T, Capacity, Policy>>& ch, T& value) {
+    return SelectCase(SelectCase::Kind::recv, ch.get(), &value, nullptr);
+}
+
+// caseRecv on an unbuffered channel without a destination waits for a
+// signal, or for the channel to be closed.
+template <typename T, typename Policy>
+SelectCase caseRecv(const std::shared_ptr<Channel<T, 0, Policy>>& ch) {
+    return SelectCase(SelectCase::Kind::recv, ch.get(), nullptr, nullptr);
+}
+
+// caseSend sends value on ch. value must stay alive until select returns.
+// Sending on a closed channel fires the case and drops the value; ok, if
+// given, is then set to false.
+template <typename T, int Capacity, typename Policy>
+    requires std::is_copy_constructible_v<T>
+SelectCase caseSend(const std::shared_ptr<Channel<T, Capacity, Policy>>& ch, const T& value, bool& ok) {
+    return SelectCase(SelectCase::Kind::send, ch.get(), const_cast<T*>(&value), &ok);
+}
+
+template <typename T, int Capacity, typename Policy>
+    requires std::is_copy_constructible_v<T>
+SelectCase caseSend(const std::shared_ptr<Channel<T, Capacity, Policy>>& ch, const T& value) {
+    return SelectCase(SelectCase::Kind::send, ch.get(), const_cast<T*>(&value), nullptr);
+}
+
+// caseSend with an rvalue moves value into ch if, and only if, the case
+// fires.
+template <typename T, int Capacity, typename Policy>
+SelectCase caseSend(const std::shared_ptr<Channel<T, Capacity, Policy>>& ch, T&& value, bool& ok) {
+    return SelectCase(SelectCase::Kind::send, ch.get(), &value, &ok, true);
+}
+
+template <typename T, int Capacity, typename Policy>
+SelectCase caseSend(const std::shared_ptr<Channel<T, Capacity, Policy>>& ch, T&& value) {
+    return SelectCase(SelectCase::Kind::send, ch.get(), &value, nullptr, true);
+}
+
+// caseDefault makes select non-blocking: it fires when no other case is
+// ready.
+inline SelectCase caseDefault() {
+    return SelectCase(SelectCase::Kind::dflt, nullptr, nullptr, nullptr);
+}
+
+// selectgo implements select. order provides 2*ncases scratch entries for
+// the poll order and the lock order. It returns the index of the case that
+// fired.
+//
+// All involved channels are locked at once, in address order, so the
+// decision between cases is atomic. When nothing is ready, the same Waiter
+// is queued on every channel and the thread parks once; the channel that
+// claims the Waiter first wins. Ready cases are polled in a random order,
+// so none of them can starve the others.
+inline int selectgo(SelectCase** cases, uint16_t* order, int ncases) {
+    uint16_t* pollorder = order;
+    uint16_t* lockorder = order + ncases;
+
+    int dflt = -1;
+    int norder = 0;
+    for (int i = 0; i < ncases; i++) {
+        SelectCase* cas = cases[i];
+        if (cas->_kind == SelectCase::Kind::dflt) {
+            if (dflt >= 0) {
+                throw std::invalid_argument("select: multiple defaults");
+            }
+            dflt = i;
+            continue;
+        }
+        if (cas->_kind == SelectCase::Kind::nil) {
+            continue;
+        }
+        auto j = cheaprandn(norder + 1);
+        pollorder[norder] = pollorder[j];
+        pollorder[j] = i;
+        norder++;
+    }
+
+    std::copy(pollorder, pollorder + norder, lockorder);
+    std::sort(lockorder, lockorder + norder, [cases](uint16_t a, uint16_t b) {
+        return std::less<ChannelBase*>()(cases[a]->_c, cases[b]->_c);
+    });
+
+    auto sellock = [&]() {
+        ChannelBase* prev = nullptr;
+        for (int i = 0; i < norder; i++) {
+            SelectCase* cas = cases[lockorder[i]];
+            if (cas->_c != prev) {
+                cas->lock();
+                prev = cas->_c;
+            }
+        }
+    };
+    auto selunlock = [&]() {
+        for (int i = norder - 1; i >= 0; i--) {
+            SelectCase* cas = cases[lockorder[i]];
+            if (i == 0 || cases[lockorder[i - 1]]->_c != cas->_c) {
+                cas->unlock();
+            }
+        }
+    };
+
+    Waiter w;
+    Waiter* wake = nullptr;
+    // poll tries the cases in poll order, starting with first if it is set.
+    auto poll = [&](int first) {
+        if (first >= 0 && cases[first]->tryLocked(&w, &wake)) {
+            return first;
+        }
+        for (int i = 0; i < norder; i++) {
+            int k = pollorder[i];
+            if (k != first && cases[k]->tryLocked(&w, &wake)) {
+                return k;
+            }
+        }
+        return -1;
+    };
+    auto finish = [&](int k) {
+        selunlock();
+        if (wake) {
+            wake->unpark();
+        }
+        return k;
+    };
+
+    // pass 1 - look for something already waiting
+    sellock();
+    int k = poll(-1);
+    if (k >= 0) {
+        return finish(k);
+    }
+    if (dflt >= 0) {
+        return finish(dflt);
+    }
+
+    for (;;) {
+        // pass 2 - enqueue on all channels, then look again: a buffered
+        // channel's lock-free path may have made a case ready meanwhile
+        // without seeing us queued.
+        w.reset();
+        for (int i = 0; i < norder; i++) {
+            cases[lockorder[i]]->enqueue(&w, lockorder[i]);
+        }
+        k = poll(-1);
+        if (k >= 0) {
+            for (int i = 0; i < norder; i++) {
+                cases[lockorder[i]]->dequeue();
+            }
+            return finish(k);
+        }
+
+        selunlock();
+        w.park();
+        sellock();
+
+        // pass 3 - dequeue from the channels that did not fire
+        for (int i = 0; i < norder; i++) {
+            cases[lockorder[i]]->dequeue();
+        }
+        int fired = w.fired();
+        SelectCase* cas = cases[fired];
+        if (cas->_sg.completed) {
+            if (cas->_ok) {
+                *cas->_ok = true;
+            }
+            return finish(fired);
+        }
+        // The fired channel only signalled readiness; retry it first, the
+        // lock-free path may still have beaten us to it.
+        k = poll(fired);
+        if (k >= 0) {
+            return finish(k);
+        }
+    }
+}
+
+// select blocks until one of cases can proceed, performs that
+// communication and returns the index of its case. If several cases are
+// ready, one is chosen at random. With a caseDefault, select does not block.
+//
+//	int v;
+//	switch (runtime::select(runtime::caseRecv(ch, v),
+//	                        runtime::caseRecv(ctx->done()),
+//	                        runtime::caseDefault())) {
+//	case 0: // received v
+//	case 1: // canceled
+//	case 2: // nothing ready
+//	}
+template <typename... Cases>
+int select(Cases&&... cases) {
+    static_assert(sizeof...(Cases) > 0, "select needs at least one case");
+    std::array<SelectCase*, sizeof...(Cases)> arr{ &cases... };
+    std::array<uint16_t, 2 * sizeof...(Cases)> order;
+    return selectgo(arr.data(), order.data(), static_cast<int>(arr.size()));
+}
+
+// select over a number of cases only known at run time.
+inline int select(std::span<SelectCase*> cases) {
+    std::vector<uint16_t> order(2 * cases.size());
+    return selectgo(cases.data(), order.data(), static_cast<int>(cases.size()));
+}
+
+}
+}
+
+#endif // GOINCPP_RUNTIME_SELECT_HPP
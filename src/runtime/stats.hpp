@@ -0,0 +1,201 @@
+// Copyright 2024 The Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef GOINCPP_RUNTIME_STATS_HPP
+#define GOINCPP_RUNTIME_STATS_HPP
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+#include "ring.hpp"
+
+namespace goincpp {
+namespace runtime {
+
+class ChannelBase;
+
+// ChanStatsSnapshot is a point-in-time copy of the stats of one channel.
+struct ChanStatsSnapshot {
+    // waitBuckets is the number of wait time histogram buckets. Bucket i
+    // counts waits of [2^i, 2^(i+1)) nanoseconds; the last one also counts
+    // everything longer.
+    static constexpr int waitBuckets = 40;
+
+    std::string name;
+    std::size_t capacity = 0;
+    // sends and receives count the elements that went through the channel.
+    uint64_t sends = 0;
+    uint64_t receives = 0;
+    // depth is the number of buffered elements, highWater its maximum.
+    std::size_t depth = 0;
+    std::size_t highWater = 0;
+    // blockedSenders and blockedReceivers are the parties blocked right now,
+    // including selects and suspended coroutines.
+    int blockedSenders = 0;
+    int blockedReceivers = 0;
+    // sendBlocks and recvBlocks count the operations that had to block.
+    uint64_t sendBlocks = 0;
+    uint64_t recvBlocks = 0;
+    // waitTime is the total time blocked operations waited.
+    std::chrono::nanoseconds waitTime{0};
+    std::array<uint64_t, waitBuckets> waitHistogram{};
+};
+
+// ChanStats holds the counters of a channel with stats enabled. Counters
+// are spread over cache-line sized shards, one picked per thread, and only
+// updated with relaxed atomics, so instrumented channels do not make their
+// users contend on a shared counter.
+class ChanStats {
+public:
+    static constexpr int shards = 16;
+
+    ChanStats(ChannelBase* owner, std::string name, std::size_t capacity)
+        : _owner(owner), _name(std::move(name)), _capacity(capacity) {}
+
+    void addSends(std::size_t n) { shard().sends.fetch_add(n, std::memory_order_relaxed); }
+    void addReceives(std::size_t n) { shard().receives.fetch_add(n, std::memory_order_relaxed); }
+
+    void addBlocked(bool send) {
+        auto& s = shard();
+        (send ? s.sendBlocks : s.recvBlocks).fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void addWait(std::chrono::steady_clock::duration d) {
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+        if (ns < 1) {
+            ns = 1;
+        }
+        int bucket = 63 - __builtin_clzll(static_cast<uint64_t>(ns));
+        if (bucket >= ChanStatsSnapshot::waitBuckets) {
+            bucket = ChanStatsSnapshot::waitBuckets - 1;
+        }
+        auto& s = shard();
+        s.waitNanos.fetch_add(static_cast<uint64_t>(ns), std::memory_order_relaxed);
+        s.waitHistogram[bucket].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // observeDepth raises the high-water mark to depth. The shared maximum
+    // is only written when it grows, which is rare once a channel reached
+    // its usual depth.
+    void observeDepth(std::size_t depth) {
+        auto hw = _highWater.load(std::memory_order_relaxed);
+        while (depth > hw && !_highWater.compare_exchange_weak(hw, depth, std::memory_order_relaxed)) {
+        }
+    }
+
+    // snapshot sums the shards. The counters are read one by one while the
+    // channel is in use, so the totals are only approximately consistent
+    // with each other.
+    ChanStatsSnapshot snapshot(int blockedSenders, int blockedReceivers) const {
+        ChanStatsSnapshot snap;
+        snap.name = _name;
+        snap.capacity = _capacity;
+        uint64_t waitNanos = 0;
+        for (auto& s : _shards) {
+            snap.sends += s.sends.load(std::memory_order_relaxed);
+            snap.receives += s.receives.load(std::memory_order_relaxed);
+            snap.sendBlocks += s.sendBlocks.load(std::memory_order_relaxed);
+            snap.recvBlocks += s.recvBlocks.load(std::memory_order_relaxed);
+            waitNanos += s.waitNanos.load(std::memory_order_relaxed);
+            for (int i = 0; i < ChanStatsSnapshot::waitBuckets; i++) {
+                snap.waitHistogram[i] += s.waitHistogram[i].load(std::memory_order_relaxed);
+            }
+        }
+        // Buffered elements are counted as sent when pushed and received
+        // when popped; a hand-off on an unbuffered channel counts both.
+        snap.depth = snap.sends > snap.receives ? snap.sends - snap.receives : 0;
+        snap.highWater = _highWater.load(std::memory_order_relaxed);
+        snap.blockedSenders = blockedSenders;
+        snap.blockedReceivers = blockedReceivers;
+        snap.waitTime = std::chrono::nanoseconds(waitNanos);
+        return snap;
+    }
+
+private:
+    friend class ChanRegistry;
+
+    struct alignas(cacheLinePadSize) Shard {
+        std::atomic<uint64_t> sends{0};
+        std::atomic<uint64_t> receives{0};
+        std::atomic<uint64_t> sendBlocks{0};
+        std::atomic<uint64_t> recvBlocks{0};
+        std::atomic<uint64_t> waitNanos{0};
+        std::array<std::atomic<uint64_t>, ChanStatsSnapshot::waitBuckets> waitHistogram{};
+    };
+
+    // shard returns the calling thread's shard. Threads are assigned
+    // shards round-robin the first time they touch any instrumented
+    // channel.
+    Shard& shard() {
+        static std::atomic<unsigned> next{0};
+        thread_local unsigned index = next.fetch_add(1, std::memory_order_relaxed) % shards;
+        return _shards[index];
+    }
+
+    ChannelBase* _owner;
+    std::string _name;
+    std::size_t _capacity;
+    alignas(cacheLinePadSize) std::atomic<std::size_t> _highWater{0};
+    Shard _shards[shards];
+
+    // Links of the registry's list of live instrumented channels.
+    ChanStats* _prev = nullptr;
+    ChanStats* _next = nullptr;
+};
+
+// ChanRegistry is the list of live channels with stats enabled. A channel
+// joins it when its stats are enabled and leaves it when destroyed.
+class ChanRegistry {
+public:
+    void add(ChanStats* s) {
+        std::lock_guard<std::mutex> lock(_mu);
+        s->_prev = nullptr;
+        s->_next = _first;
+        if (_first) {
+            _first->_prev = s;
+        }
+        _first = s;
+    }
+
+    void remove(ChanStats* s) {
+        std::lock_guard<std::mutex> lock(_mu);
+        if (s->_prev) {
+            s->_prev->_next = s->_next;
+        } else {
+            _first = s->_next;
+        }
+        if (s->_next) {
+            s->_next->_prev = s->_prev;
+        }
+    }
+
+    // forEach calls fn with the owner of every registered channel. The
+    // registry lock is held meanwhile, so none of them can be destroyed
+    // during the call.
+    template <typename Fn>
+    void forEach(Fn&& fn) {
+        std::lock_guard<std::mutex> lock(_mu);
+        for (ChanStats* s = _first; s; s = s->_next) {
+            fn(s->_owner);
+        }
+    }
+
+    static ChanRegistry& instance() {
+        static ChanRegistry registry;
+        return registry;
+    }
+
+private:
+    std::mutex _mu;
+    ChanStats* _first = nullptr;
+};
+
+}
+}
+
+#endif // GOINCPP_RUNTIME_STATS_HPP
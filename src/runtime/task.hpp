@@ -0,0 +1,69 @@
+// Copyright 2024 The Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef GOINCPP_RUNTIME_TASK_HPP
+#define GOINCPP_RUNTIME_TASK_HPP
+
+#include <coroutine>
+#include <exception>
+#include <utility>
+
+#include "executor.hpp"
+
+namespace goincpp {
+namespace runtime {
+
+// Task is a fire-and-forget coroutine, the coroutine counterpart of a
+// goroutine. It does not run until it is spawned, and frees its frame when
+// it returns.
+//
+//	runtime::Task worker(std::shared_ptr<runtime::Channel<int, 16>> ch) {
+//	    while (auto v = co_await ch->asyncReceive()) {
+//	        ...
+//	    }
+//	}
+//	runtime::spawn(worker(ch));
+class Task {
+public:
+    struct promise_type {
+        Task get_return_object() {
+            return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        // An exception escaping a Task has nobody to propagate to.
+        void unhandled_exception() { std::terminate(); }
+    };
+
+    Task(Task&& other) noexcept : _h(std::exchange(other._h, {})) {}
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+    Task& operator=(Task&&) = delete;
+
+    // A Task destroyed without being spawned never runs.
+    ~Task() {
+        if (_h) {
+            _h.destroy();
+        }
+    }
+
+private:
+    friend void spawn(Task task, Executor& ex);
+
+    explicit Task(std::coroutine_handle<promise_type> h) : _h(h) {}
+
+    std::coroutine_handle<promise_type> _h;
+};
+
+// spawn starts task on ex. The task owns itself from then on.
+inline void spawn(Task task, Executor& ex = defaultExecutor()) {
+    ex.resume(std::exchange(task._h, {}));
+}
+
+}
+}
+
+#endif // GOINCPP_RUNTIME_TASK_HPP
@@ -0,0 +1,187 @@
+// Copyright 2024 The Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef GOINCPP_RUNTIME_WAITQ_HPP
+#define GOINCPP_RUNTIME_WAITQ_HPP
+
+#include <atomic>
+#include <chrono>
+
+#include "park.hpp"
+#include "proc.hpp"
+
+namespace goincpp {
+namespace runtime {
+
+// Waiter is a thread or goroutine blocked in a channel operation. A select registers the
+// same Waiter on every channel it waits for: the first channel to claim it
+// wakes it up, the others skip it.
+class Waiter {
+public:
+    // reset makes the waiter claimable again before it is (re-)enqueued.
+    // It also records whether the caller is a goroutine, which then parks
+    // by switching to another goroutine rather than blocking its thread.
+    void reset() {
+        _fired = -1;
+        _state.store(waiting, std::memory_order_relaxed);
+        _g = getg();
+    }
+
+    // tryClaim marks the waiter as woken on behalf of the case at index.
+    // Only the first claim succeeds.
+    bool tryClaim(int index) {
+        int expected = waiting;
+        if (_state.compare_exchange_strong(expected, claimed, std::memory_order_acq_rel)) {
+            _fired = index;
+            return true;
+        }
+        return false;
+    }
+
+    // fired returns the index of the case that claimed the waiter.
+    int fired() const { return _fired; }
+
+    // park blocks until unpark is called. A waiter is unparked exactly once
+    // per successful claim, after the claimer released the channel lock.
+    void park() {
+        if (_g) {
+            gopark(_g);
+        } else {
+            _parker.park();
+        }
+    }
+
+    // parkUntil is park with a deadline; it returns false on timeout.
+    template <typename Clock, typename Duration>
+    bool parkUntil(const std::chrono::time_point<Clock, Duration>& deadline) {
+        if (_g) {
+            auto timeout = std::chrono::ceil<std::chrono::steady_clock::duration>(deadline - Clock::now());
+            return goparkUntil(_g, std::chrono::steady_clock::now() + timeout);
+        }
+        return _parker.parkUntil(deadline);
+    }
+
+    // unpark wakes the parked thread, or calls the hook set by onUnpark.
+    void unpark() {
+        if (_hook) {
+            _hook(_hookArg);
+        } else if (_g) {
+            goready(_g);
+        } else {
+            _parker.unpark();
+        }
+    }
+
+    // onUnpark makes unpark call hook(arg) instead of waking a thread. It is
+    // used by waiters that are suspended coroutines rather than blocked
+    // threads. The hook runs on the waker's thread, after it released the
+    // channel lock.
+    void onUnpark(void (*hook)(void*), void* arg) {
+        _hook = hook;
+        _hookArg = arg;
+    }
+
+private:
+    static constexpr int waiting = 0;
+    static constexpr int claimed = 1;
+
+    std::atomic<int> _state{waiting};
+    int _fired = -1;
+    Parker _parker;
+    G* _g = nullptr;
+    void (*_hook)(void*) = nullptr;
+    void* _hookArg = nullptr;
+};
+
+// Sudog represents a Waiter in the wait queue of one channel.
+struct Sudog {
+    Waiter* waiter = nullptr;
+    // elem points at the value to send, or at the slot to receive into.
+    void* elem = nullptr;
+    // movable tells whether a sent elem may be moved from.
+    bool movable = false;
+    // index is the case index within a select, 0 for plain operations.
+    int index = 0;
+    // completed is set by the claimer when it performed the operation on
+    // the waiter's behalf (a direct hand-off on an unbuffered channel).
+    // Otherwise the waiter retries after it is woken up.
+    bool completed = false;
+
+    bool queued = false;
+    Sudog* prev = nullptr;
+    Sudog* next = nullptr;
+};
+
+// WaitQueue is an intrusive FIFO of Sudogs, guarded by the channel lock.
+// len may be read without the lock to decide whether a wake-up is needed.
+class WaitQueue {
+public:
+    void enqueue(Sudog* sg) {
+        sg->completed = false;
+        sg->queued = true;
+        sg->next = nullptr;
+        sg->prev = _last;
+        if (_last) {
+            _last->next = sg;
+        } else {
+            _first = sg;
+        }
+        _last = sg;
+        _len.fetch_add(1);
+        // Pairs with the fence of lock-free wakers: after this, the caller
+        // re-checks the channel state they publish before reading len.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+
+    void remove(Sudog* sg) {
+        if (!sg->queued) {
+            return;
+        }
+        if (sg->prev) {
+            sg->prev->next = sg->next;
+        } else {
+            _first = sg->next;
+        }
+        if (sg->next) {
+            sg->next->prev = sg->prev;
+        } else {
+            _last = sg->prev;
+        }
+        sg->prev = sg->next = nullptr;
+        sg->queued = false;
+        _len.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    // dequeue removes and claims the first Sudog whose waiter has not been
+    // claimed through another channel yet. Sudogs belonging to self, the
+    // caller's own pending select, are left in place.
+    Sudog* dequeue(const Waiter* self = nullptr) {
+        Sudog* sg = _first;
+        while (sg) {
+            Sudog* next = sg->next;
+            if (sg->waiter != self) {
+                remove(sg);
+                if (sg->waiter->tryClaim(sg->index)) {
+                    return sg;
+                }
+            }
+            sg = next;
+        }
+        return nullptr;
+    }
+
+    bool empty() const { return _first == nullptr; }
+
+    int len() const { return _len.load(std::memory_order_relaxed); }
+
+private:
+    Sudog* _first = nullptr;
+    Sudog* _last = nullptr;
+    std::atomic<int> _len{0};
+};
+
+}
+}
+
+#endif // GOINCPP_RUNTIME_WAITQ_HPP
@@ -0,0 +1,81 @@
+// Copyright 2024 The Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef GOINCPP_TIME_CLOCK_HPP
+#define GOINCPP_TIME_CLOCK_HPP
+
+#include <chrono>
+
+#if defined(__linux__)
+#include <ctime>
+#endif
+
+namespace goincpp {
+namespace time {
+
+// CoarseClock is a monotonic clock for hot paths that can trade precision
+// for speed, such as checking context deadlines. On Linux it reads
+// CLOCK_MONOTONIC_COARSE, which the kernel updates on its timer tick: the
+// vDSO returns it without touching the TSC, in a few nanoseconds. It lags
+// behind steady_clock, usually by up to resolution(), but by more on a
+// tickless kernel whose CPUs were idle, so it only answers questions for
+// which a late answer is harmless.
+//
+// It shares the epoch of steady_clock (CLOCK_MONOTONIC), so its time points
+// are steady_clock time points and the two can be compared and mixed.
+struct CoarseClock {
+    using duration = std::chrono::steady_clock::duration;
+    using rep = duration::rep;
+    using period = duration::period;
+    using time_point = std::chrono::steady_clock::time_point;
+    static constexpr bool is_steady = true;
+
+    static time_point now() noexcept {
+#if defined(__linux__) && defined(CLOCK_MONOTONIC_COARSE)
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+        return time_point(std::chrono::duration_cast<duration>(
+            std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec)));
+#else
+        return std::chrono::steady_clock::now();
+#endif
+    }
+
+    // resolution is the granularity of now().
+    static duration resolution() noexcept {
+#if defined(__linux__) && defined(CLOCK_MONOTONIC_COARSE)
+        static const duration res = []() {
+            struct timespec ts;
+            if (clock_getres(CLOCK_MONOTONIC_COARSE, &ts) != 0) {
+                return duration(std::chrono::milliseconds(10));
+            }
+            return std::chrono::duration_cast<duration>(
+                std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec));
+        }();
+        return res;
+#else
+        return duration(1);
+#endif
+    }
+};
+
+// deadlineAfter returns the steady deadline timeout from now. It reads the
+// precise clock once: the coarse one could make the deadline early.
+inline std::chrono::steady_clock::time_point
+deadlineAfter(std::chrono::steady_clock::duration timeout) {
+    return std::chrono::steady_clock::now() + timeout;
+}
+
+// expired reports whether the steady deadline has passed, reading the
+// coarse clock. It may report a deadline as not yet passed for a while
+// after it did, never the other way around.
+inline bool
+expired(std::chrono::steady_clock::time_point deadline) {
+    return CoarseClock::now() >= deadline;
+}
+
+}
+}
+
+#endif // GOINCPP_TIME_CLOCK_HPP
@@ -0,0 +1,137 @@
+// Copyright 2024 The Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef GOINCPP_TIME_STATS_HPP
+#define GOINCPP_TIME_STATS_HPP
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace goincpp {
+namespace time {
+
+// LatencyBuckets maps durations to the buckets of a log-linear histogram:
+// each power of two of nanoseconds is split into subBuckets linear buckets,
+// so a bucket is never wider than 1/subBuckets of the values it holds.
+// Durations below subBuckets nanoseconds get a bucket each; those beyond
+// 2^octaves nanoseconds (about 18 minutes) share the last one.
+struct LatencyBuckets {
+    static constexpr int subBits = 3;
+    static constexpr int subBuckets = 1 << subBits;
+    static constexpr int octaves = 40;
+    static constexpr int count = (octaves - subBits + 1) * subBuckets;
+
+    static int index(uint64_t ns) {
+        if (ns < subBuckets) {
+            return static_cast<int>(ns);
+        }
+        int msb = 63 - __builtin_clzll(ns);
+        if (msb >= octaves) {
+            return count - 1;
+        }
+        int shift = msb - subBits;
+        return shift * subBuckets + static_cast<int>(ns >> shift);
+    }
+
+    // upperBound returns the largest duration counted by bucket i.
+    static uint64_t upperBound(int i) {
+        if (i < 2 * subBuckets) {
+            return static_cast<uint64_t>(i);
+        }
+        int shift = i / subBuckets - 1;
+        uint64_t lower = static_cast<uint64_t>(i % subBuckets + subBuckets) << shift;
+        return lower + (uint64_t(1) << shift) - 1;
+    }
+};
+
+// TimerStatsSnapshot is a point-in-time copy of the stats of the TimerWheel.
+struct TimerStatsSnapshot {
+    // outstanding is the number of timers pending right now.
+    uint64_t outstanding = 0;
+    // fired and canceled count the timers that fired, and those stopped
+    // while pending.
+    uint64_t fired = 0;
+    uint64_t canceled = 0;
+    // lateness is the histogram of how long after its deadline each fired
+    // timer's callback started, bucketed by LatencyBuckets. It includes the
+    // tick rounding of the wheel and the time spent in earlier callbacks.
+    std::array<uint64_t, LatencyBuckets::count> lateness{};
+    std::chrono::nanoseconds maxLateness{0};
+
+    // percentile returns the lateness that fraction q of the fired timers
+    // did not exceed, rounded up to the end of its bucket, so within 1/8
+    // of the exact value. It returns zero if no timer fired.
+    std::chrono::nanoseconds percentile(double q) const {
+        uint64_t total = 0;
+        for (auto n : lateness) {
+            total += n;
+        }
+        if (total == 0) {
+            return std::chrono::nanoseconds(0);
+        }
+        auto rank = static_cast<uint64_t>(q * static_cast<double>(total) + 0.5);
+        if (rank < 1) {
+            rank = 1;
+        } else if (rank > total) {
+            rank = total;
+        }
+        uint64_t seen = 0;
+        for (int i = 0; i < LatencyBuckets::count; i++) {
+            seen += lateness[i];
+            if (seen >= rank) {
+                auto bound = std::chrono::nanoseconds(LatencyBuckets::upperBound(i));
+                return bound < maxLateness ? bound : maxLateness;
+            }
+        }
+        return maxLateness;
+    }
+};
+
+// TimerStats holds the counters of the TimerWheel. Updates are relaxed
+// atomics only: lateness is recorded by the wheel's thread as it runs the
+// callbacks, cancellations by whoever stops a timer, and snapshots are
+// taken without stopping either.
+class TimerStats {
+public:
+    void addFired(std::chrono::steady_clock::duration late) {
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(late).count();
+        if (ns < 0) {
+            ns = 0;
+        }
+        _fired.fetch_add(1, std::memory_order_relaxed);
+        _lateness[LatencyBuckets::index(static_cast<uint64_t>(ns))].fetch_add(1, std::memory_order_relaxed);
+        auto max = _maxLateness.load(std::memory_order_relaxed);
+        while (ns > max && !_maxLateness.compare_exchange_weak(max, ns, std::memory_order_relaxed)) {
+        }
+    }
+
+    void addCanceled() { _canceled.fetch_add(1, std::memory_order_relaxed); }
+
+    // snapshot copies the counters one by one, so they are only
+    // approximately consistent with each other.
+    TimerStatsSnapshot snapshot(uint64_t outstanding) const {
+        TimerStatsSnapshot snap;
+        snap.outstanding = outstanding;
+        snap.fired = _fired.load(std::memory_order_relaxed);
+        snap.canceled = _canceled.load(std::memory_order_relaxed);
+        for (int i = 0; i < LatencyBuckets::count; i++) {
+            snap.lateness[i] = _lateness[i].load(std::memory_order_relaxed);
+        }
+        snap.maxLateness = std::chrono::nanoseconds(_maxLateness.load(std::memory_order_relaxed));
+        return snap;
+    }
+
+private:
+    std::atomic<uint64_t> _fired{0};
+    std::atomic<uint64_t> _canceled{0};
+    std::atomic<int64_t> _maxLateness{0};
+    std::array<std::atomic<uint64_t>, LatencyBuckets::count> _lateness{};
+};
+
+}
+}
+
+#endif // GOINCPP_TIME_STATS_HPP
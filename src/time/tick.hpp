@@ -0,0 +1,143 @@
+// Copyright 2024 The Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef GOINCPP_TIME_TICK_HPP
+#define GOINCPP_TIME_TICK_HPP
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+
+#include "timer.hpp"
+
+namespace goincpp {
+namespace time {
+
+// A Ticker holds a channel that delivers the current time at intervals.
+//
+// Ticks stay on the grid of the start time: tick k is due at start + k*d,
+// however late the previous one fired, so a ticker does not drift. When the
+// timer thread falls behind by more than one interval, the ticks missed
+// meanwhile are skipped instead of delivered in a burst. A tick that finds
+// the channel full is dropped, to make up for slow receivers.
+//
+// Tickers run on the process-wide TimerWheel like timers do; a ticker costs
+// no thread, and re-arming it allocates nothing.
+class Ticker {
+public:
+    // Ticker starts ticking every d. It throws std::invalid_argument if d
+    // is not positive.
+    explicit Ticker(std::chrono::steady_clock::duration d) : _state(std::make_shared<State>()) {
+        if (d <= std::chrono::steady_clock::duration::zero()) {
+            throw std::invalid_argument("non-positive interval for newTicker");
+        }
+        _state->c = TickChannel::make();
+        start(d);
+    }
+
+    Ticker(const Ticker&) = delete;
+    Ticker& operator=(const Ticker&) = delete;
+
+    ~Ticker() {
+        stop();
+    }
+
+    // stop turns off the ticker. After stop, no more ticks are sent. stop
+    // does not close the channel, to prevent a concurrent receive from
+    // seeing an erroneous tick.
+    void stop() {
+        std::shared_ptr<State> self;
+        do {
+            std::lock_guard<std::mutex> lock(_state->mu);
+            if (_state->stopped) {
+                return;
+            }
+            _state->stopped = true;
+            // Otherwise a tick is being delivered, and releases the state
+            // once it sees stopped.
+            if (TimerWheel::instance().remove(&_state->node)) {
+                self = std::move(_state->self);
+            }
+        } while(0);
+    }
+
+    // reset stops the ticker and resets its period to d. The next tick
+    // arrives after d has elapsed, and a tick not received yet is
+    // discarded. It throws std::invalid_argument if d is not positive.
+    void reset(std::chrono::steady_clock::duration d) {
+        if (d <= std::chrono::steady_clock::duration::zero()) {
+            throw std::invalid_argument("non-positive interval for Ticker.reset");
+        }
+        start(d);
+    }
+
+    std::shared_ptr<TickChannel> channel() const { return _state->c; }
+
+private:
+    // State is what the wheel refers to. While the ticker is armed, or a
+    // tick is being delivered, self keeps it alive, so the callback only
+    // captures a plain pointer and fits std::function without allocating.
+    struct State {
+        std::mutex mu;
+        TimerWheel::Node node;
+        std::chrono::steady_clock::duration period{};
+        std::chrono::steady_clock::time_point next;
+        std::shared_ptr<TickChannel> c;
+        bool stopped = true;
+        std::shared_ptr<State> self;
+
+        void arm() {
+            TimerWheel::instance().add(&node, next, [this]() { fire(); });
+        }
+
+        void fire() {
+            std::shared_ptr<State> release;
+            std::lock_guard<std::mutex> lock(mu);
+            if (stopped) {
+                release = std::move(self);
+                return;
+            }
+            if (TimerWheel::instance().pending(&node)) {
+                // reset re-armed the ticker meanwhile.
+                return;
+            }
+            auto now = std::chrono::steady_clock::now();
+            c->trySend(now);
+            next += period;
+            if (next <= now) {
+                next += period * ((now - next) / period + 1);
+            }
+            arm();
+        }
+    };
+
+    void start(std::chrono::steady_clock::duration d) {
+        std::lock_guard<std::mutex> lock(_state->mu);
+        std::chrono::steady_clock::time_point stale;
+        _state->c->tryReceive(stale);
+        _state->period = d;
+        _state->next = std::chrono::steady_clock::now() + d;
+        _state->stopped = false;
+        if (!_state->self) {
+            _state->self = _state;
+        }
+        _state->arm();
+    }
+
+    std::shared_ptr<State> _state;
+};
+
+// newTicker returns a new Ticker that sends the current time on its channel
+// every d. Stop the ticker to release associated resources.
+inline std::shared_ptr<Ticker>
+newTicker(std::chrono::steady_clock::duration d)
+{
+    return std::make_shared<Ticker>(d);
+}
+
+}
+}
+
+#endif // GOINCPP_TIME_TICK_HPP
@@ -5,40 +5,85 @@
 #ifndef GOINCPP_TIME_TIMER_HPP
 #define GOINCPP_TIME_TIMER_HPP
 
-#include <iostream>
 #include <chrono>
-#include <thread>
-#include <atomic>
 #include <functional>
+#include <memory>
+#include <stdexcept>
+
+#include "../runtime/chan.hpp"
+#include "wheel.hpp"
 
 namespace goincpp {
 namespace time {
 
+// TickChannel is the channel timers and tickers deliver to. It has room for
+// one value: a tick that finds it full is dropped rather than blocking the
+// timer thread.
+using TickChannel = runtime::Channel<std::chrono::steady_clock::time_point, 1>;
+
+// Timer runs a callback once after a duration. All timers share the
+// process-wide TimerWheel, and with it a single background thread; starting
+// or stopping one does not create or join a thread.
+//
+// A Timer made by newTimer sends the current time on its channel instead.
 class Timer {
 public:
-    Timer() : _isRunning(false) {}
-
-    // Start the timer with a specified duration
-    void start(std::chrono::milliseconds duration, std::function<void()> callback) {
-        _isRunning.store(true);
-        _timerThread = std::thread([this, duration, callback]() {
-            std::this_thread::sleep_for(duration);
-            if (_isRunning.load()) {
-                callback();
-            }
-        });
+    Timer() = default;
+
+    // Timer with a channel sends on c when it fires; see newTimer.
+    explicit Timer(std::shared_ptr<TickChannel> c) : _c(std::move(c)) {}
+
+    Timer(const Timer&) = delete;
+    Timer& operator=(const Timer&) = delete;
+
+    // Start the timer with a specified duration. Starting a running timer
+    // restarts it with the new duration and callback.
+    void start(std::chrono::steady_clock::duration duration, std::function<void()> callback) {
+        startAt(std::chrono::steady_clock::now() + duration, std::move(callback));
     }
 
-    // Stop the timer
-    void stop() {
-        _isRunning.store(false);
-        if (_timerThread.joinable()) {
-            _timerThread.join();
+    // startAt starts the timer for a steady deadline, sparing a clock read.
+    void startAt(std::chrono::steady_clock::time_point deadline, std::function<void()> callback) {
+        TimerWheel::instance().add(&_node, deadline, std::move(callback));
+    }
+
+    // Stop the timer. It returns true if the call stopped the timer, false
+    // if it already fired or was stopped. It does not wait for a callback
+    // that is already running, so it may be called from that callback.
+    //
+    // Once stop returns, a receive from the channel of the timer blocks
+    // rather than deliver a value sent before, unless it raced with the
+    // timer firing.
+    bool stop() {
+        bool active = TimerWheel::instance().remove(&_node);
+        drain();
+        return active;
+    }
+
+    // reset changes a timer made by newTimer to expire after duration d.
+    // It returns true if the timer had been active, false if it had expired
+    // or been stopped. Like stop, it discards a value not received yet.
+    // Timers with a callback are restarted by start instead.
+    bool reset(std::chrono::steady_clock::duration d) {
+        if (!_c) {
+            throw std::logic_error("time: reset called on a timer without a channel");
         }
+        bool active = TimerWheel::instance().remove(&_node);
+        drain();
+        auto c = _c;
+        TimerWheel::instance().add(&_node, std::chrono::steady_clock::now() + d, [c]() {
+            c->trySend(std::chrono::steady_clock::now());
+        });
+        return active;
     }
 
-    bool isRunning() const {
-        return _isRunning.load();
+    // channel returns the channel of a timer made by newTimer, nullptr for
+    // timers with a callback.
+    std::shared_ptr<TickChannel> channel() const { return _c; }
+
+    // isRunning reports whether the timer is started and has not fired yet.
+    bool isRunning() {
+        return TimerWheel::instance().pending(&_node);
     }
 
     ~Timer() {
@@ -46,18 +91,61 @@ public:
     }
 
 private:
-    std::atomic<bool> _isRunning; // Atomic flag to check if the timer is running
-    std::thread _timerThread;     // Thread object for the timer
+    void drain() {
+        std::chrono::steady_clock::time_point stale;
+        if (_c) {
+            _c->tryReceive(stale);
+        }
+    }
+
+    TimerWheel::Node _node;
+    std::shared_ptr<TickChannel> _c;
 };
 
-std::chrono::milliseconds
+// newTimer creates a new Timer that will send the current time on its
+// channel after at least duration d.
+inline std::shared_ptr<Timer>
+newTimer(std::chrono::steady_clock::duration d)
+{
+    auto t = std::make_shared<Timer>(TickChannel::make());
+    t->reset(d);
+    return t;
+}
+
+// after waits for the duration to elapse and then sends the current time on
+// the returned channel. It is equivalent to newTimer(d)->channel(), except
+// that there is no timer to stop: the timer is released once it fires.
+inline std::shared_ptr<TickChannel>
+after(std::chrono::steady_clock::duration d)
+{
+    auto c = TickChannel::make();
+    auto n = new TimerWheel::Node;
+    // The wheel moves the callback out of n before running it, so the
+    // callback may free n.
+    TimerWheel::instance().add(n, std::chrono::steady_clock::now() + d, [c, n]() {
+        c->trySend(std::chrono::steady_clock::now());
+        delete n;
+    });
+    return c;
+}
+
+// timerStats returns the stats of the timers of the process: those of
+// Timer, Ticker and after, and with them the deadlines of contexts.
+inline TimerStatsSnapshot
+timerStats()
+{
+    return TimerWheel::instance().stats();
+}
+
+inline std::chrono::milliseconds
 util(std::chrono::system_clock::time_point d)
 {
-    return std::chrono::duration_cast<std::chrono::milliseconds>(
+    // Rounded up, so that a timer started with it never fires early.
+    return std::chrono::ceil<std::chrono::milliseconds>(
         d - std::chrono::system_clock::now());
 }
 
 }
 }
 
-#endif // GOINCPP_TIME_TIMER_HPP
\ No newline at end of file
+#endif // GOINCPP_TIME_TIMER_HPP
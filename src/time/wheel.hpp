@@ -0,0 +1,327 @@
+// Copyright 2024 The Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef GOINCPP_TIME_WHEEL_HPP
+#define GOINCPP_TIME_WHEEL_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "stats.hpp"
+
+namespace goincpp {
+namespace time {
+
+// TimerWheel runs the callbacks of all timers of the process from a single
+// background thread. Timers are kept in a hierarchical timing wheel: four
+// levels of 256 slots, with a tick of one millisecond on the first level and
+// each further level covering 256 times the span of the one below. Adding
+// and removing a timer is O(1). Timers due within 256 ticks sit in the first
+// level; the others are cascaded down one level whenever the level below
+// completes a rotation.
+//
+// Callbacks run on the wheel's thread one after the other, so they should
+// be short. A timer never fires early; it fires within about a tick of its
+// deadline unless an earlier callback delays it. How late they actually run
+// is recorded, see stats. Between timers, the thread sleeps until the next
+// tick with work to do, and catches up on the ticks before it at once.
+//
+// The destructor stops the thread, after the callback it may be running,
+// and drops the timers still pending; it must not be called from one of
+// the callbacks. The wheel shared by the process is never destroyed.
+class TimerWheel {
+public:
+    using Clock = std::chrono::steady_clock;
+    using NowFunc = Clock::time_point (*)();
+
+    static constexpr Clock::duration tick = std::chrono::milliseconds(1);
+
+    // Link threads Nodes into the list of a slot.
+    struct Link {
+        Link* prev = this;
+        Link* next = this;
+    };
+
+    // Node is a timer registered with the wheel. It is embedded in its
+    // owner and must stay in place while pending.
+    struct Node : Link {
+        // when is the deadline as given, expires the tick it falls in.
+        Clock::time_point when;
+        uint64_t expires = 0;
+        bool pending = false;
+        std::function<void()> fn;
+    };
+
+    // now is the clock the wheel reads; tests may pass a clock of their own.
+    explicit TimerWheel(NowFunc now = &Clock::now) : _now(now), _epoch(now()) {
+        _thread = std::thread([this]() { run(); });
+    }
+
+    ~TimerWheel() {
+        do {
+            std::lock_guard<std::mutex> lock(_mu);
+            _stop = true;
+        } while(0);
+        _cond.notify_one();
+        _thread.join();
+    }
+
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+
+    // add schedules fn to run on the wheel's thread at when. If n is still
+    // pending, it is rescheduled and its previous callback dropped.
+    void add(Node* n, Clock::time_point when, std::function<void()> fn) {
+        // A replaced callback is destroyed after the lock is released, see
+        // remove.
+        std::function<void()> old;
+        do {
+            std::lock_guard<std::mutex> lock(_mu);
+            if (n->pending) {
+                unlink(n);
+                old = std::move(n->fn);
+            } else {
+                if (_count == 0) {
+                    // Nothing to catch up on; start counting from now.
+                    _base = currentTick();
+                }
+                _count++;
+            }
+            n->fn = std::move(fn);
+            n->pending = true;
+            n->when = when;
+            n->expires = tickAt(when);
+            if (n->expires <= _base) {
+                n->expires = _base + 1;
+            }
+            insert(n);
+            if (n->expires < _wakeTick) {
+                _cond.notify_one();
+            }
+        } while(0);
+    }
+
+    // remove cancels n. It returns true if n was pending, in which case its
+    // callback will not run. It never waits for a callback that is already
+    // running, so it may be called from within that very callback.
+    bool remove(Node* n) {
+        std::function<void()> fn;
+        do {
+            std::lock_guard<std::mutex> lock(_mu);
+            if (!n->pending) {
+                return false;
+            }
+            unlink(n);
+            n->pending = false;
+            _count--;
+            _stats.addCanceled();
+            // The callback may hold the last reference to the owner of n;
+            // destroy it outside the lock.
+            fn = std::move(n->fn);
+        } while(0);
+        return true;
+    }
+
+    bool pending(const Node* n) {
+        std::lock_guard<std::mutex> lock(_mu);
+        return n->pending;
+    }
+
+    // stats returns the counters of the wheel and the histogram of how late
+    // its timers fired.
+    TimerStatsSnapshot stats() {
+        uint64_t outstanding;
+        do {
+            std::lock_guard<std::mutex> lock(_mu);
+            outstanding = _count;
+        } while(0);
+        return _stats.snapshot(outstanding);
+    }
+
+    // instance returns the wheel shared by the whole process. It lives
+    // until the process exits.
+    static TimerWheel& instance() {
+        static TimerWheel* wheel = new TimerWheel;
+        return *wheel;
+    }
+
+private:
+    static constexpr int levels = 4;
+    static constexpr int slotBits = 8;
+    static constexpr uint64_t slots = uint64_t(1) << slotBits;
+    static constexpr uint64_t slotMask = slots - 1;
+    static constexpr uint64_t maxDelta = (uint64_t(1) << (slotBits * levels)) - 1;
+
+    uint64_t currentTick() const {
+        return static_cast<uint64_t>((_now() - _epoch) / tick);
+    }
+
+    // tickAt rounds when up to a tick, so that a timer never fires early.
+    // It does not overflow for deadlines as late as time_point::max().
+    uint64_t tickAt(Clock::time_point when) const {
+        if (when <= _epoch) {
+            return 0;
+        }
+        auto d = when - _epoch;
+        auto t = static_cast<uint64_t>(d / tick);
+        if (d % tick != Clock::duration::zero()) {
+            t++;
+        }
+        return t;
+    }
+
+    Clock::time_point timeAt(uint64_t t) const {
+        return _epoch + tick * static_cast<Clock::rep>(t);
+    }
+
+    void insert(Node* n) {
+        uint64_t delta = n->expires - _base;
+        uint64_t at = n->expires;
+        if (delta > maxDelta) {
+            // Further out than the wheel reaches: park it in the last
+            // level as if it were due at the end of its reach. Its expiry
+            // is kept, so it is cascaded again until it is really due.
+            delta = maxDelta;
+            at = _base + maxDelta;
+        }
+        int level = 0;
+        while (level < levels - 1 && delta >= (uint64_t(1) << (slotBits * (level + 1)))) {
+            level++;
+        }
+        Link& head = _wheel[level][(at >> (slotBits * level)) & slotMask];
+        n->next = &head;
+        n->prev = head.prev;
+        head.prev->next = n;
+        head.prev = n;
+    }
+
+    static void unlink(Link* l) {
+        l->prev->next = l->next;
+        l->next->prev = l->prev;
+        l->prev = l->next = l;
+    }
+
+    // cascade moves the timers of a slot of a higher level down.
+    void cascade(int level, uint64_t index) {
+        Link& head = _wheel[level][index];
+        Link* l = head.next;
+        while (l != &head) {
+            Link* next = l->next;
+            unlink(l);
+            insert(static_cast<Node*>(l));
+            l = next;
+        }
+    }
+
+    // Due is a callback taken off the wheel, with its deadline.
+    struct Due {
+        Clock::time_point when;
+        std::function<void()> fn;
+    };
+
+    // advance processes tick _base + 1, appending the callbacks that are
+    // due to fns.
+    void advance(std::vector<Due>& fns) {
+        _base++;
+        uint64_t index = _base & slotMask;
+        for (int level = 1; index == 0 && level < levels; level++) {
+            index = (_base >> (slotBits * level)) & slotMask;
+            cascade(level, index);
+        }
+        Link& head = _wheel[0][_base & slotMask];
+        while (head.next != &head) {
+            auto n = static_cast<Node*>(head.next);
+            unlink(n);
+            n->pending = false;
+            _count--;
+            fns.push_back({n->when, std::move(n->fn)});
+        }
+    }
+
+    // nextTick returns the next tick with work to do: the earliest tick at
+    // which a non-empty slot is either due, on the first level, or
+    // cascaded, on the others. No tick before it changes the wheel. It
+    // returns UINT64_MAX if the wheel is empty.
+    uint64_t nextTick() const {
+        uint64_t next = UINT64_MAX;
+        for (int level = 0; level < levels; level++) {
+            int shift = slotBits * level;
+            // Slot k & slotMask of this level is processed at tick
+            // k << shift; the next rotation starts after the last one done.
+            uint64_t first = (_base >> shift) + 1;
+            for (uint64_t k = first; k < first + slots; k++) {
+                const Link& head = _wheel[level][k & slotMask];
+                if (head.next != &head) {
+                    next = std::min(next, k << shift);
+                    break;
+                }
+            }
+        }
+        return next;
+    }
+
+    void run() {
+        std::vector<Due> fns;
+        std::unique_lock<std::mutex> lock(_mu);
+        for (;;) {
+            if (_stop) {
+                return;
+            }
+            if (_count == 0) {
+                _wakeTick = UINT64_MAX;
+                _cond.wait(lock);
+                continue;
+            }
+            uint64_t now = currentTick();
+            while (_base < now && _count > 0) {
+                // The ticks before the next one with work are skipped.
+                _base = std::min(now, nextTick()) - 1;
+                advance(fns);
+            }
+            if (!fns.empty()) {
+                lock.unlock();
+                for (auto& due : fns) {
+                    _stats.addFired(_now() - due.when);
+                    due.fn();
+                }
+                fns.clear();
+                lock.lock();
+                continue;
+            }
+            if (_count == 0) {
+                continue;
+            }
+            _wakeTick = nextTick();
+            // Waited for rather than until, as now need not be the clock
+            // of the condition variable.
+            _cond.wait_for(lock, timeAt(_wakeTick) - _now());
+        }
+    }
+
+    const NowFunc _now;
+    const Clock::time_point _epoch;
+    std::mutex _mu;
+    std::condition_variable _cond;
+    // _base is the last tick processed.
+    uint64_t _base = 0;
+    // _wakeTick is the tick the wheel's thread sleeps until.
+    uint64_t _wakeTick = UINT64_MAX;
+    std::size_t _count = 0;
+    TimerStats _stats;
+    Link _wheel[levels][slots];
+    bool _stop = false;
+    std::thread _thread;
+};
+
+}
+}
+
+#endif // GOINCPP_TIME_WHEEL_HPP
@@ -0,0 +1,98 @@
+// Copyright 2024 The Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#define BOOST_TEST_MODULE GoincppTestBufioModule
+#include <boost/test/included/unit_test.hpp>
+
+#include <sstream>
+#include <string>
+
+#include "../src/bufio/writer.hpp"
+
+using namespace goincpp;
+
+BOOST_AUTO_TEST_CASE(test_writer_buffers) {
+    std::ostringstream os;
+    io::Writer w(os);
+    bufio::Writer b(w, 100);
+    BOOST_CHECK_EQUAL(b.Size(), 128u);
+    BOOST_CHECK_EQUAL(b.Available(), 128u);
+
+    BOOST_CHECK(b.WriteString("hello") == nullptr);
+    BOOST_CHECK(b.WriteByte(' ') == nullptr);
+    std::size_t n = 0;
+    BOOST_CHECK(b.Write("world", 5, &n) == nullptr);
+    BOOST_CHECK_EQUAL(n, 5u);
+    BOOST_CHECK_EQUAL(b.Buffered(), 11u);
+    BOOST_CHECK_EQUAL(b.Available(), 117u);
+    // Nothing reached the stream yet.
+    BOOST_CHECK(os.str().empty());
+
+    BOOST_CHECK(b.Flush() == nullptr);
+    BOOST_CHECK_EQUAL(os.str(), "hello world");
+    BOOST_CHECK_EQUAL(b.Buffered(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(test_writer_fills_and_bypasses) {
+    std::ostringstream os;
+    io::Writer w(os);
+    bufio::Writer b(w, 64);
+
+    std::string expected;
+    for (int i = 0; i < 1000; i++) {
+        BOOST_CHECK(b.WriteByte(static_cast<char>('a' + i % 26)) == nullptr);
+        expected += static_cast<char>('a' + i % 26);
+    }
+    // Full buffers were passed on as they filled up.
+    BOOST_CHECK_EQUAL(os.str().size(), 960u);
+
+    // A large write tops up the buffer, flushes it, then skips it.
+    std::string large(1000, 'x');
+    std::size_t n = 0;
+    BOOST_CHECK(b.WriteString(large, &n) == nullptr);
+    BOOST_CHECK_EQUAL(n, large.size());
+    expected += large;
+    BOOST_CHECK_EQUAL(b.Buffered(), 0u);
+    BOOST_CHECK_EQUAL(os.str(), expected);
+
+    BOOST_CHECK(b.WriteString(large) == nullptr);
+    BOOST_CHECK_EQUAL(b.Buffered(), 0u);
+    BOOST_CHECK(b.Flush() == nullptr);
+    BOOST_CHECK_EQUAL(os.str(), expected + large);
+}
+
+BOOST_AUTO_TEST_CASE(test_writer_read_from) {
+    std::string data;
+    for (int i = 0; i < 10000; i++) {
+        data += std::to_string(i);
+    }
+    std::istringstream is(data);
+    std::ostringstream os;
+    io::Writer w(os);
+    bufio::Writer b(w, 64);
+    BOOST_CHECK(b.WriteString("<") == nullptr);
+    std::size_t n = 0;
+    BOOST_CHECK(b.ReadFrom(is, &n) == nullptr);
+    BOOST_CHECK_EQUAL(n, data.size());
+    BOOST_CHECK(b.Flush() == nullptr);
+    BOOST_CHECK_EQUAL(os.str(), "<" + data);
+}
+
+BOOST_AUTO_TEST_CASE(test_writer_error_is_sticky) {
+    std::ostringstream os;
+    os.setstate(std::ios::badbit);
+    io::Writer w(os);
+    bufio::Writer b(w, 64);
+    BOOST_CHECK(b.WriteString("buffered") == nullptr);
+    BOOST_CHECK(b.Flush() == io::errShortWrite);
+    BOOST_CHECK(b.WriteByte('x') == io::errShortWrite);
+    BOOST_CHECK(b.Flush() == io::errShortWrite);
+
+    std::ostringstream good;
+    io::Writer gw(good);
+    b.Reset(gw);
+    BOOST_CHECK(b.WriteString("ok") == nullptr);
+    BOOST_CHECK(b.Flush() == nullptr);
+    BOOST_CHECK_EQUAL(good.str(), "ok");
+}
@@ -6,7 +6,11 @@
 #include <boost/test/included/unit_test.hpp>
 
 #include "../src/runtime/chan.hpp"
+#include "../src/runtime/select.hpp"
+#include "../src/runtime/park.hpp"
+#include "../src/runtime/task.hpp"
 #include <thread>
+#include <vector>
 
 using namespace goincpp::runtime;
 
@@ -170,4 +174,646 @@ BOOST_AUTO_TEST_CASE(test_int_one_c_r) {
     BOOST_TEST_MESSAGE("thd_receiver starting.");
     BOOST_CHECK_EQUAL(ch >> value, true);
     BOOST_TEST_MESSAGE("thd_receiver starting.");
-}
\ No newline at end of file
+}
+BOOST_AUTO_TEST_CASE(test_int_buffered_blocks_when_full) {
+    auto ch = goincpp::runtime::Channel<int, 2>::make();
+    std::atomic<int> sent{0};
+
+    std::thread thd_sender([ch, &sent]() {
+        for (int i = 0; i < 3; i++) {
+            ch << i;
+            sent++;
+        }
+    });
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    BOOST_CHECK_EQUAL(sent.load(), 2);
+    BOOST_CHECK_EQUAL(ch->len(), 2);
+
+    int value;
+    for (int i = 0; i < 3; i++) {
+        BOOST_CHECK_EQUAL(ch >> value, true);
+        BOOST_CHECK_EQUAL(value, i);
+    }
+
+    thd_sender.join();
+    BOOST_CHECK_EQUAL(sent.load(), 3);
+    BOOST_CHECK_EQUAL(ch->len(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_int_buffered_mpmc) {
+    auto ch = goincpp::runtime::Channel<int, 16>::make();
+    const int producers = 4, consumers = 4, perProducer = 20000;
+    std::atomic<long> sum{0};
+
+    std::vector<std::thread> thds;
+    for (int p = 0; p < producers; p++) {
+        thds.emplace_back([ch]() {
+            for (int i = 1; i <= perProducer; i++) {
+                ch << i;
+            }
+        });
+    }
+    for (int c = 0; c < consumers; c++) {
+        thds.emplace_back([ch, &sum]() {
+            int value;
+            for (int i = 0; i < perProducer; i++) {
+                ch >> value;
+                sum += value;
+            }
+        });
+    }
+    for (auto& thd : thds) {
+        thd.join();
+    }
+
+    BOOST_CHECK_EQUAL(sum.load(), long(producers) * perProducer * (perProducer + 1) / 2);
+}
+
+BOOST_AUTO_TEST_CASE(test_int_spsc_in_order) {
+    auto ch = SpscChannel<int, 8>::make();
+    const int count = 100000;
+    std::vector<int> received;
+
+    std::thread thd_c([ch, &received]() {
+        int value;
+        int batch[5];
+        while (received.size() < count) {
+            if (received.size() % 2 == 0) {
+                ch >> value;
+                received.push_back(value);
+            } else {
+                auto n = ch->receiveN(batch);
+                received.insert(received.end(), batch, batch + n);
+            }
+        }
+    });
+    for (int i = 0; i < count; i++) {
+        ch << i;
+    }
+    thd_c.join();
+
+    BOOST_CHECK_EQUAL(received.size(), count);
+    bool inOrder = true;
+    for (int i = 0; i < count; i++) {
+        inOrder = inOrder && received[i] == i;
+    }
+    BOOST_CHECK(inOrder);
+    BOOST_CHECK_EQUAL(ch->len(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_int_mpsc) {
+    auto ch = MpscChannel<int, 16>::make();
+    const int producers = 4, perProducer = 20000;
+
+    std::vector<std::thread> thds;
+    for (int p = 0; p < producers; p++) {
+        thds.emplace_back([ch]() {
+            for (int i = 1; i <= perProducer; i++) {
+                ch << i;
+            }
+        });
+    }
+    long sum = 0;
+    int value;
+    for (int i = 0; i < producers * perProducer; i++) {
+        ch >> value;
+        sum += value;
+    }
+    for (auto& thd : thds) {
+        thd.join();
+    }
+    ch->close();
+
+    BOOST_CHECK_EQUAL(sum, long(producers) * perProducer * (perProducer + 1) / 2);
+    BOOST_CHECK_EQUAL(ch->len(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_select_default) {
+    auto chi = Channel<int, 1>::make();
+    auto sig = UnbufferedChannel::make();
+    int value = 0;
+
+    BOOST_CHECK_EQUAL(select(caseRecv(chi, value), caseRecv(sig), caseDefault()), 2);
+
+    chi << 7;
+    BOOST_CHECK_EQUAL(select(caseRecv(chi, value), caseRecv(sig), caseDefault()), 0);
+    BOOST_CHECK_EQUAL(value, 7);
+
+    // The buffer is full again, so only the default case can fire.
+    chi << 8;
+    BOOST_CHECK_EQUAL(select(caseSend(chi, 9), caseDefault()), 1);
+}
+
+BOOST_AUTO_TEST_CASE(test_select_blocks_until_ready) {
+    auto chi = Channel<int, 4>::make();
+    auto chs = Channel<std::string, 1>::make();
+    auto sig = UnbufferedChannel::make();
+
+    std::thread thd_sender([chs, sig]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        chs << std::string("hello");
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        sig->send();
+    });
+
+    int i;
+    std::string s;
+    BOOST_CHECK_EQUAL(select(caseRecv(chi, i), caseRecv(chs, s), caseRecv(sig)), 1);
+    BOOST_CHECK_EQUAL(s, "hello");
+    BOOST_CHECK_EQUAL(select(caseRecv(chi, i), caseRecv(chs, s), caseRecv(sig)), 2);
+
+    thd_sender.join();
+}
+
+BOOST_AUTO_TEST_CASE(test_select_closed_and_send) {
+    auto in = Channel<int, 0>::make();
+    auto out = Channel<int, 1>::make();
+
+    std::thread thd_closer([in]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        in->close();
+    });
+
+    int value;
+    bool ok = true;
+    BOOST_CHECK_EQUAL(select(caseRecv(in, value, ok), caseSend(out, 1)), 1);
+    BOOST_CHECK_EQUAL(out->len(), 1);
+    BOOST_CHECK_EQUAL(select(caseRecv(in, value, ok), caseSend(out, 2)), 0);
+    BOOST_CHECK_EQUAL(ok, false);
+
+    thd_closer.join();
+}
+
+BOOST_AUTO_TEST_CASE(test_select_fairness) {
+    auto a = Channel<int, 1024>::make();
+    auto b = Channel<int, 1024>::make();
+    for (int i = 0; i < 1000; i++) {
+        a << i;
+        b << i;
+    }
+
+    int counts[2] = {0, 0};
+    int value;
+    for (int i = 0; i < 1000; i++) {
+        counts[select(caseRecv(a, value), caseRecv(b, value))]++;
+    }
+    BOOST_CHECK(counts[0] > 400);
+    BOOST_CHECK(counts[1] > 400);
+}
+
+BOOST_AUTO_TEST_CASE(test_select_many_selectors) {
+    auto a = Channel<int, 0>::make();
+    auto b = Channel<int, 2>::make();
+    const int selectors = 4, perChannel = 5000;
+    std::atomic<long> sum{0};
+    auto quit = UnbufferedChannel::make();
+
+    std::vector<std::thread> thds;
+    for (int i = 0; i < selectors; i++) {
+        thds.emplace_back([a, b, quit, &sum]() {
+            int value;
+            for (;;) {
+                switch (select(caseRecv(a, value), caseRecv(b, value), caseRecv(quit))) {
+                case 0:
+                case 1:
+                    sum += value;
+                    break;
+                default:
+                    return;
+                }
+            }
+        });
+    }
+    std::thread thd_a([a]() { for (int i = 1; i <= perChannel; i++) a << i; });
+    std::thread thd_b([b]() { for (int i = 1; i <= perChannel; i++) b << i; });
+    thd_a.join();
+    thd_b.join();
+    while (b->len() > 0) {
+        std::this_thread::yield();
+    }
+    quit->close();
+    for (auto& thd : thds) {
+        thd.join();
+    }
+
+    BOOST_CHECK_EQUAL(sum.load(), 2L * perChannel * (perChannel + 1) / 2);
+}
+
+BOOST_AUTO_TEST_CASE(test_int_sendN_receiveN) {
+    auto ch = Channel<int, 64>::make();
+    const int total = 100000;
+
+    std::size_t sent = 0;
+    std::thread thd_sender([ch, &sent]() {
+        std::vector<int> batch(100);
+        for (int i = 0; i < total; i += batch.size()) {
+            for (std::size_t j = 0; j < batch.size(); j++) {
+                batch[j] = i + j;
+            }
+            sent += ch->sendN(batch);
+        }
+        ch->close();
+    });
+
+    std::vector<int> buf(32);
+    int next = 0;
+    std::size_t n;
+    while ((n = ch->receiveN(buf)) > 0) {
+        BOOST_CHECK(n <= buf.size());
+        for (std::size_t j = 0; j < n; j++) {
+            BOOST_CHECK_EQUAL(buf[j], next++);
+        }
+    }
+    BOOST_CHECK_EQUAL(next, total);
+
+    thd_sender.join();
+    BOOST_CHECK_EQUAL(sent, total);
+}
+
+BOOST_AUTO_TEST_CASE(test_int_sendN_closed) {
+    auto ch = Channel<int, 2>::make();
+    std::vector<int> values{1, 2, 3, 4};
+
+    std::thread thd_closer([ch]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        ch->close();
+    });
+    BOOST_CHECK_EQUAL(ch->sendN(values), 2);
+    thd_closer.join();
+
+    std::vector<int> buf(4);
+    BOOST_CHECK_EQUAL(ch->receiveN(buf), 2);
+    BOOST_CHECK_EQUAL(ch->receiveN(buf), 0);
+}
+
+struct CopyCounter {
+    static inline std::atomic<int> copies{0};
+    int value = 0;
+
+    CopyCounter() = default;
+    explicit CopyCounter(int v) : value(v) {}
+    CopyCounter(const CopyCounter& o) : value(o.value) { copies++; }
+    CopyCounter(CopyCounter&&) = default;
+    CopyCounter& operator=(const CopyCounter& o) { value = o.value; copies++; return *this; }
+    CopyCounter& operator=(CopyCounter&&) = default;
+};
+
+BOOST_AUTO_TEST_CASE(test_move_only_buffered) {
+    auto ch = Channel<std::unique_ptr<int>, 1>::make();
+
+    std::thread thd_sender([ch]() {
+        for (int i = 0; i < 100; i++) {
+            ch->send(std::make_unique<int>(i));
+        }
+        ch->emplace(new int(100));
+    });
+
+    std::unique_ptr<int> p;
+    for (int i = 0; i <= 100; i++) {
+        ch >> p;
+        BOOST_REQUIRE(p != nullptr);
+        BOOST_CHECK_EQUAL(*p, i);
+    }
+    thd_sender.join();
+
+    auto q = std::make_unique<int>(7);
+    BOOST_CHECK_EQUAL(select(caseSend(ch, std::move(q))), 0);
+    BOOST_CHECK(q == nullptr);
+    auto r = std::make_unique<int>(8);
+    BOOST_CHECK_EQUAL(select(caseSend(ch, std::move(r)), caseDefault()), 1);
+    BOOST_CHECK(r != nullptr); // not moved from, the case did not fire
+}
+
+BOOST_AUTO_TEST_CASE(test_no_copies) {
+    auto buffered = Channel<CopyCounter, 1>::make();
+    auto unbuffered = Channel<CopyCounter, 0>::make();
+    CopyCounter::copies = 0;
+
+    std::thread thd_sender([buffered, unbuffered]() {
+        for (int i = 0; i < 100; i++) {
+            buffered->send(CopyCounter(i));
+            buffered->emplace(i);
+            select(caseSend(unbuffered, CopyCounter(i)));
+        }
+    });
+
+    CopyCounter c;
+    for (int i = 0; i < 100; i++) {
+        buffered >> c;
+        BOOST_CHECK_EQUAL(c.value, i);
+        buffered >> c;
+        BOOST_CHECK_EQUAL(c.value, i);
+        select(caseRecv(unbuffered, c));
+        BOOST_CHECK_EQUAL(c.value, i);
+    }
+    thd_sender.join();
+
+    BOOST_CHECK_EQUAL(CopyCounter::copies.load(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_unbuffered_rendezvous) {
+    auto ch = Channel<std::string, 0>::make();
+    std::atomic<bool> sent{false};
+
+    std::thread thd_sender([ch, &sent]() {
+        ch << std::string("ping");
+        sent = true;
+    });
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    BOOST_CHECK(!sent.load()); // no receiver yet, the sender is blocked
+
+    std::string value;
+    BOOST_CHECK_EQUAL(ch >> value, true);
+    BOOST_CHECK_EQUAL(value, "ping");
+    thd_sender.join();
+    BOOST_CHECK(sent.load());
+
+    auto chp = Channel<std::unique_ptr<int>, 0>::make();
+    std::thread thd_emplacer([chp]() { chp->emplace(new int(42)); });
+    std::unique_ptr<int> p;
+    chp >> p;
+    BOOST_REQUIRE(p != nullptr);
+    BOOST_CHECK_EQUAL(*p, 42);
+    thd_emplacer.join();
+}
+
+BOOST_AUTO_TEST_CASE(test_signal_closed) {
+    auto sig = UnbufferedChannel::make();
+    sig->close();
+    BOOST_CHECK(sig->closed());
+    BOOST_CHECK_EQUAL(sig->receive(), true);
+    BOOST_CHECK_EQUAL(sig->select(), true);
+    sig->send(); // dropped, must not block
+    BOOST_CHECK_EQUAL(select(caseRecv(sig)), 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_parker) {
+    Parker p;
+
+    // A permit left by unpark is consumed without blocking.
+    p.unpark();
+    p.park();
+
+    auto start = std::chrono::steady_clock::now();
+    BOOST_CHECK(!p.parkUntil(start + std::chrono::milliseconds(50)));
+    BOOST_CHECK(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(50));
+
+    std::thread thd_unparker([&p]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        p.unpark();
+    });
+    start = std::chrono::steady_clock::now();
+    BOOST_CHECK(p.parkUntil(start + std::chrono::seconds(10)));
+    BOOST_CHECK(std::chrono::steady_clock::now() - start < std::chrono::seconds(5));
+    thd_unparker.join();
+}
+
+BOOST_AUTO_TEST_CASE(test_int_buffered_try_and_timed) {
+    auto ch = Channel<int, 1>::make();
+    int value = 0;
+
+    BOOST_CHECK(ch->tryReceive(value) == ChanStatus::timeout);
+    BOOST_CHECK(ch->trySend(1) == ChanStatus::ok);
+    BOOST_CHECK(ch->trySend(2) == ChanStatus::timeout);
+
+    auto start = std::chrono::steady_clock::now();
+    BOOST_CHECK(ch->sendFor(2, std::chrono::milliseconds(20)) == ChanStatus::timeout);
+    BOOST_CHECK(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(20));
+
+    BOOST_CHECK(ch->tryReceive(value) == ChanStatus::ok);
+    BOOST_CHECK_EQUAL(value, 1);
+
+    start = std::chrono::steady_clock::now();
+    BOOST_CHECK(ch->receiveUntil(value, start + std::chrono::milliseconds(20)) == ChanStatus::timeout);
+    BOOST_CHECK(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(20));
+
+    std::thread thd_s([ch]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        ch << 3;
+    });
+    BOOST_CHECK(ch->receiveFor(value, std::chrono::seconds(10)) == ChanStatus::ok);
+    BOOST_CHECK_EQUAL(value, 3);
+    thd_s.join();
+
+    ch << 4;
+    ch->close();
+    BOOST_CHECK(ch->trySend(5) == ChanStatus::closed);
+    BOOST_CHECK(ch->tryReceive(value) == ChanStatus::ok);
+    BOOST_CHECK_EQUAL(value, 4);
+    BOOST_CHECK(ch->tryReceive(value) == ChanStatus::closed);
+    BOOST_CHECK(ch->receiveFor(value, std::chrono::seconds(10)) == ChanStatus::closed);
+}
+
+BOOST_AUTO_TEST_CASE(test_unbuffered_try_and_timed) {
+    auto ch = Channel<std::unique_ptr<int>, 0>::make();
+    auto value = std::make_unique<int>(1);
+
+    BOOST_CHECK(ch->trySend(std::move(value)) == ChanStatus::timeout);
+    BOOST_CHECK(ch->sendFor(std::move(value), std::chrono::milliseconds(10)) == ChanStatus::timeout);
+    BOOST_REQUIRE(value);
+
+    std::unique_ptr<int> received;
+    std::thread thd_r([ch, &received]() {
+        ch->receiveFor(received, std::chrono::seconds(10));
+    });
+    BOOST_CHECK(ch->sendFor(std::move(value), std::chrono::seconds(10)) == ChanStatus::ok);
+    thd_r.join();
+    BOOST_CHECK(!value);
+    BOOST_REQUIRE(received);
+    BOOST_CHECK_EQUAL(*received, 1);
+
+    auto done = UnbufferedChannel::make();
+    BOOST_CHECK(done->receiveFor(std::chrono::milliseconds(10)) == ChanStatus::timeout);
+    done->close();
+    BOOST_CHECK(done->tryReceive() == ChanStatus::closed);
+}
+
+BOOST_AUTO_TEST_CASE(test_timed_racing_deadlines) {
+    // Deadlines expiring while the other side is completing a hand-off must
+    // neither lose nor duplicate values.
+    auto ch = Channel<int, 0>::make();
+    const int count = 2000;
+    std::atomic<long> sent{0}, received{0};
+
+    std::thread thd_s([ch, &sent]() {
+        for (int i = 1; i <= count; i++) {
+            if (ch->sendFor(i, std::chrono::microseconds(20)) == ChanStatus::ok) {
+                sent += i;
+            }
+        }
+        ch->close();
+    });
+    int value;
+    for (;;) {
+        auto status = ch->receiveFor(value, std::chrono::microseconds(20));
+        if (status == ChanStatus::closed) {
+            break;
+        }
+        if (status == ChanStatus::ok) {
+            received += value;
+        }
+    }
+    thd_s.join();
+
+    BOOST_CHECK_EQUAL(sent.load(), received.load());
+}
+
+Task echo(std::shared_ptr<Channel<int, 0>> in, std::shared_ptr<Channel<int, 4>> out) {
+    while (auto value = co_await in->asyncReceive()) {
+        co_await out->asyncSend(*value * 2);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_coroutine_send_receive) {
+    auto in = Channel<int, 0>::make();
+    auto out = Channel<int, 4>::make();
+    ThreadPool pool(2);
+    for (int i = 0; i < 3; i++) {
+        spawn(echo(in, out), pool);
+    }
+
+    long sum = 0;
+    std::thread thd_s([in]() {
+        for (int i = 1; i <= 1000; i++) {
+            in << i;
+        }
+    });
+    int value;
+    for (int i = 0; i < 1000; i++) {
+        out >> value;
+        sum += value;
+    }
+    thd_s.join();
+    in->close();
+
+    BOOST_CHECK_EQUAL(sum, 1000L * 1001);
+}
+
+Task waitSignal(std::shared_ptr<UnbufferedChannel> start, std::shared_ptr<Channel<int, 0>> in,
+                std::shared_ptr<Channel<int, 1024>> out) {
+    co_await start;
+    auto value = co_await in->asyncReceive();
+    co_await out->asyncSend(value ? *value : -1);
+}
+
+BOOST_AUTO_TEST_CASE(test_coroutine_many_waiters) {
+    // Many more suspended operations than threads.
+    const int count = 20000;
+    auto start = UnbufferedChannel::make();
+    auto in = Channel<int, 0>::make();
+    auto out = Channel<int, 1024>::make();
+    ThreadPool pool(2);
+    for (int i = 0; i < count; i++) {
+        spawn(waitSignal(start, in, out), pool);
+    }
+    start->close();
+
+    std::thread thd_s([in]() {
+        for (int i = 1; i <= count / 2; i++) {
+            in << i;
+        }
+        in->close();
+    });
+    long sum = 0;
+    int closed = 0;
+    int value;
+    for (int i = 0; i < count; i++) {
+        out >> value;
+        if (value < 0) {
+            closed++;
+        } else {
+            sum += value;
+        }
+    }
+    thd_s.join();
+
+    BOOST_CHECK_EQUAL(sum, long(count / 2) * (count / 2 + 1) / 2);
+    BOOST_CHECK_EQUAL(closed, count / 2);
+}
+
+static std::optional<ChanStatsSnapshot> findStats(const std::string& name) {
+    for (auto& snap : channelStats()) {
+        if (snap.name == name) {
+            return snap;
+        }
+    }
+    return std::nullopt;
+}
+
+BOOST_AUTO_TEST_CASE(test_channel_stats) {
+    auto ch = Channel<int, 4>::make();
+    BOOST_CHECK(!ch->stats());
+    ch->enableStats("jobs");
+
+    for (int i = 0; i < 3; i++) {
+        ch << i;
+    }
+    auto snap = ch->stats();
+    BOOST_REQUIRE(snap);
+    BOOST_CHECK_EQUAL(snap->name, "jobs");
+    BOOST_CHECK_EQUAL(snap->capacity, 4);
+    BOOST_CHECK_EQUAL(snap->sends, 3);
+    BOOST_CHECK_EQUAL(snap->depth, 3);
+    BOOST_CHECK_EQUAL(snap->highWater, 3);
+
+    int value;
+    for (int i = 0; i < 3; i++) {
+        ch >> value;
+    }
+
+    // A receiver blocks on the empty channel until a value arrives.
+    std::thread thd_r([ch]() {
+        int value;
+        ch >> value;
+    });
+    while (ch->stats()->blockedReceivers == 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    ch << 3;
+    thd_r.join();
+
+    snap = findStats("jobs");
+    BOOST_REQUIRE(snap);
+    BOOST_CHECK_EQUAL(snap->sends, 4);
+    BOOST_CHECK_EQUAL(snap->receives, 4);
+    BOOST_CHECK_EQUAL(snap->depth, 0);
+    BOOST_CHECK_EQUAL(snap->highWater, 3);
+    BOOST_CHECK_EQUAL(snap->blockedReceivers, 0);
+    BOOST_CHECK_EQUAL(snap->recvBlocks, 1);
+    BOOST_CHECK_EQUAL(snap->sendBlocks, 0);
+    BOOST_CHECK(snap->waitTime >= std::chrono::milliseconds(10));
+    uint64_t waits = 0;
+    for (auto n : snap->waitHistogram) {
+        waits += n;
+    }
+    BOOST_CHECK_EQUAL(waits, 1);
+
+    ch.reset();
+    BOOST_CHECK(!findStats("jobs"));
+}
+
+BOOST_AUTO_TEST_CASE(test_channel_stats_unbuffered) {
+    auto ch = Channel<int, 0>::make();
+    ch->enableStats("handoff");
+    std::thread thd_s([ch]() {
+        for (int i = 0; i < 100; i++) {
+            ch << i;
+        }
+    });
+    int value;
+    for (int i = 0; i < 100; i++) {
+        ch >> value;
+    }
+    thd_s.join();
+
+    auto snap = ch->stats();
+    BOOST_REQUIRE(snap);
+    BOOST_CHECK_EQUAL(snap->capacity, 0);
+    BOOST_CHECK_EQUAL(snap->sends, 100);
+    BOOST_CHECK_EQUAL(snap->receives, 100);
+    BOOST_CHECK_EQUAL(snap->depth, 0);
+    BOOST_CHECK(snap->sendBlocks + snap->recvBlocks > 0);
+}
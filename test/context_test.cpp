@@ -5,10 +5,51 @@
 #define BOOST_TEST_MODULE GoincppTestContextModule
 #include <boost/test/included/unit_test.hpp>
 
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+#include <thread>
+#include <poll.h>
+
 #include "../src/context/context.hpp"
+#include "../src/context/chan.hpp"
+#include "../src/context/poller.hpp"
+#include "../src/runtime/task.hpp"
 
 using namespace goincpp::context;
 
+// Allocations made by the current thread while countAllocs is set. The
+// replacements stay out of line so that GCC does not pair an inlined
+// malloc/free with the new/delete expressions at the call sites.
+static thread_local bool countAllocs = false;
+static thread_local int allocs = 0;
+
+[[gnu::noinline]] void* operator new(std::size_t n) {
+    if (countAllocs) {
+        allocs++;
+    }
+    if (void* p = std::malloc(n ? n : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+[[gnu::noinline]] void* operator new(std::size_t n, std::align_val_t align) {
+    if (countAllocs) {
+        allocs++;
+    }
+    std::size_t a = static_cast<std::size_t>(align);
+    if (void* p = std::aligned_alloc(a, (n + a - 1) / a * a)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+[[gnu::noinline]] void operator delete(void* p) noexcept { std::free(p); }
+[[gnu::noinline]] void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+[[gnu::noinline]] void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+[[gnu::noinline]] void operator delete(void* p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+
 BOOST_AUTO_TEST_CASE(test_background) {
     auto e = background();
     BOOST_CHECK(e != nullptr);
@@ -18,10 +59,510 @@ BOOST_AUTO_TEST_CASE(test_background) {
     BOOST_CHECK_EQUAL(b->string(), "context.Background");
 }
 
+BOOST_AUTO_TEST_CASE(test_background_singleton) {
+    BOOST_CHECK(background() == background());
+    BOOST_CHECK(todo() == todo());
+    BOOST_CHECK(background() != todo());
+}
+
 BOOST_AUTO_TEST_CASE(test_withCancel) {
     auto e = background();
     BOOST_CHECK(e != nullptr);
     auto [c, cancel] = withCancel(e);
     cancel();
     BOOST_CHECK(c->done() == closedChan);
-}
\ No newline at end of file
+}
+goincpp::runtime::Task awaitDone(std::shared_ptr<Context> ctx, std::shared_ptr<goincpp::runtime::Channel<int, 1>> out) {
+    co_await ctx->done();
+    co_await out->asyncSend(1);
+}
+
+BOOST_AUTO_TEST_CASE(test_await_done) {
+    auto [c, cancel] = withCancel(background());
+    auto out = goincpp::runtime::Channel<int, 1>::make();
+    goincpp::runtime::spawn(awaitDone(c, out));
+
+    int value = 0;
+    BOOST_CHECK(out->receiveFor(value, std::chrono::milliseconds(20)) == goincpp::runtime::ChanStatus::timeout);
+    cancel();
+    out >> value;
+    BOOST_CHECK_EQUAL(value, 1);
+}
+
+BOOST_AUTO_TEST_CASE(test_withTimeout) {
+    auto [c, cancel] = withTimeout(background(), std::chrono::milliseconds(20));
+    BOOST_CHECK(c->deadline().has_value());
+    BOOST_CHECK(c->err() == nullptr);
+    auto start = std::chrono::steady_clock::now();
+    c->done()->receive();
+    BOOST_CHECK(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(19));
+    BOOST_CHECK(c->err() == deadlineExceededError);
+    cancel();
+    BOOST_CHECK(c->err() == deadlineExceededError);
+}
+
+BOOST_AUTO_TEST_CASE(test_withTimeout_cancel_early) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 1000; i++) {
+        auto [c, cancel] = withTimeout(background(), std::chrono::hours(1));
+        cancel();
+        BOOST_CHECK(c->err() == canceledError);
+    }
+    // Canceling neither waits for the deadline nor for a timer thread.
+    BOOST_CHECK(std::chrono::steady_clock::now() - start < std::chrono::seconds(1));
+}
+
+BOOST_AUTO_TEST_CASE(test_withDeadline_past) {
+    auto [c, cancel] = withDeadline(background(), std::chrono::system_clock::now() - std::chrono::seconds(1));
+    BOOST_CHECK(c->err() == deadlineExceededError);
+    cancel();
+}
+
+BOOST_AUTO_TEST_CASE(test_withCancel_child) {
+    auto [parent, cancelParent] = withCancel(background());
+    auto [child, cancelChild] = withCancel(parent);
+    BOOST_CHECK(child->err() == nullptr);
+    cancelParent();
+    BOOST_CHECK(child->err() == canceledError);
+    BOOST_CHECK(child->done()->closed());
+    cancelChild();
+
+    // A child of a canceled parent starts out canceled.
+    auto [late, cancelLate] = withCancel(parent);
+    BOOST_CHECK(late->err() == canceledError);
+    cancelLate();
+}
+
+BOOST_AUTO_TEST_CASE(test_withCancel_child_released) {
+    auto [parent, cancelParent] = withCancel(background());
+    std::weak_ptr<Context> weak;
+    do {
+        auto [child, cancelChild] = withCancel(parent);
+        weak = child;
+        cancelChild();
+    } while(0);
+    // Canceling the child removed it from its parent.
+    BOOST_CHECK(weak.expired());
+    BOOST_CHECK(parent->err() == nullptr);
+    cancelParent();
+}
+
+BOOST_AUTO_TEST_CASE(test_withCancel_many_children) {
+    constexpr int n = 100000;
+    auto [parent, cancelParent] = withCancel(background());
+    std::vector<std::shared_ptr<CancelCtx>> children;
+    std::vector<CancelFunc> cancels;
+    for (int i = 0; i < n; i++) {
+        auto [c, cancel] = withCancel(parent);
+        children.push_back(c);
+        cancels.push_back(cancel);
+    }
+    // Half of them go away before the parent is canceled.
+    for (int i = 0; i < n; i += 2) {
+        cancels[i]();
+    }
+    cancelParent();
+    for (auto& c : children) {
+        BOOST_CHECK(c->err() == canceledError);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_withCancel_deep_chain) {
+    constexpr int n = 100000;
+    auto [root, cancelRoot] = withCancel(background());
+    std::shared_ptr<Context> c = root;
+    std::vector<CancelFunc> cancels;
+    for (int i = 0; i < n; i++) {
+        auto [child, cancel] = withCancel(c);
+        c = child;
+        cancels.push_back(cancel);
+    }
+    cancelRoot();
+    BOOST_CHECK(c->err() == canceledError);
+    // Releasing the chain at scope exit must not recurse once per level
+    // either.
+}
+
+BOOST_AUTO_TEST_CASE(test_withTimeout_cancels_children) {
+    auto [parent, cancelParent] = withTimeout(background(), std::chrono::milliseconds(10));
+    auto [child, cancelChild] = withCancel(parent);
+    child->done()->receive();
+    BOOST_CHECK(child->err() == deadlineExceededError);
+    cancelChild();
+    cancelParent();
+}
+
+struct RequestID { using type = std::string; };
+struct Attempt { using type = int; };
+
+BOOST_AUTO_TEST_CASE(test_withValue_typed) {
+    auto [c, cancel] = withCancel(background());
+    auto v1 = withValue<RequestID>(c, "req-1");
+    auto v2 = withValue<Attempt>(v1, 3);
+    auto v3 = withValue<RequestID>(v2, "req-2");
+
+    BOOST_CHECK(valueOf<RequestID>(c) == nullptr);
+    BOOST_REQUIRE(valueOf<RequestID>(v1) != nullptr);
+    BOOST_CHECK_EQUAL(*valueOf<RequestID>(v1), "req-1");
+    BOOST_CHECK(valueOf<Attempt>(v1) == nullptr);
+    BOOST_CHECK_EQUAL(*valueOf<RequestID>(v2), "req-1");
+    BOOST_CHECK_EQUAL(*valueOf<Attempt>(v2), 3);
+    BOOST_CHECK_EQUAL(*valueOf<RequestID>(v3), "req-2");
+    BOOST_CHECK_EQUAL(*valueOf<Attempt>(v3), 3);
+
+    // Value contexts pass cancellation through.
+    auto [child, cancelChild] = withCancel(v3);
+    BOOST_CHECK_EQUAL(*valueOf<Attempt>(child), 3);
+    cancel();
+    BOOST_CHECK(v3->err() == canceledError);
+    BOOST_CHECK(child->err() == canceledError);
+    cancelChild();
+}
+
+BOOST_AUTO_TEST_CASE(test_value_deep_chain) {
+    constexpr int n = 10000;
+    auto [root, cancel] = withCancelCause(background());
+    std::shared_ptr<Context> c = withValue<RequestID>(root, "deep");
+    for (int i = 0; i < n; i++) {
+        c = withValue<Attempt>(c, i);
+        BOOST_CHECK_EQUAL(*valueOf<RequestID>(c), "deep");
+    }
+    BOOST_CHECK_EQUAL(*valueOf<Attempt>(c), n - 1);
+
+    auto [child, cancelChild] = withCancel(c);
+    auto err = goincpp::errors::newError("boom");
+    cancel(err);
+    BOOST_CHECK(child->err() == canceledError);
+    BOOST_CHECK(cause(child) == err);
+    BOOST_CHECK(cause(c) == err);
+    cancelChild();
+
+    auto w = withoutCancel(c);
+    BOOST_CHECK(cause(w) == nullptr);
+    BOOST_CHECK_EQUAL(*valueOf<RequestID>(w), "deep");
+}
+
+BOOST_AUTO_TEST_CASE(test_afterFunc) {
+    auto [c, cancel] = withCancel(background());
+    auto ran = goincpp::runtime::Channel<int, 1>::make();
+    auto stop = afterFunc(c, [ran]() { ran << 1; });
+    auto stopped = afterFunc(c, [ran]() { ran << 2; });
+    BOOST_CHECK(stopped());
+    BOOST_CHECK(!stopped());
+
+    int value = 0;
+    BOOST_CHECK(ran->receiveFor(value, std::chrono::milliseconds(10)) == goincpp::runtime::ChanStatus::timeout);
+    cancel();
+    ran >> value;
+    BOOST_CHECK_EQUAL(value, 1);
+    BOOST_CHECK(!stop());
+    BOOST_CHECK(ran->receiveFor(value, std::chrono::milliseconds(10)) == goincpp::runtime::ChanStatus::timeout);
+
+    // On a canceled context f runs right away.
+    auto late = afterFunc(c, [ran]() { ran << 3; });
+    ran >> value;
+    BOOST_CHECK_EQUAL(value, 3);
+    BOOST_CHECK(!late());
+}
+
+// A CustomCtx is a cancelable Context that is none of the built-in ones.
+class CustomCtx : public Context {
+public:
+    virtual std::optional<std::chrono::system_clock::time_point> deadline() const override {
+        return std::nullopt;
+    }
+    virtual std::shared_ptr<UnbufferedChannel> done() override { return _done; }
+    virtual Error err() override {
+        std::lock_guard<std::mutex> lock(_mu);
+        return _err;
+    }
+    virtual std::optional<std::any> value(const void*) override { return std::nullopt; }
+
+    void cancel() {
+        do {
+            std::lock_guard<std::mutex> lock(_mu);
+            _err = canceledError;
+        } while(0);
+        _done->close();
+    }
+
+private:
+    std::mutex _mu;
+    Error _err;
+    std::shared_ptr<UnbufferedChannel> _done = UnbufferedChannel::make();
+};
+
+BOOST_AUTO_TEST_CASE(test_afterFunc_custom_context) {
+    auto custom = std::make_shared<CustomCtx>();
+    auto ran = goincpp::runtime::Channel<int, 1>::make();
+    // The stop function is dropped; the registration stays.
+    afterFunc(custom, [ran]() { ran << 1; });
+    auto [c, cancel] = withCancel(custom);
+
+    int value = 0;
+    BOOST_CHECK(ran->receiveFor(value, std::chrono::milliseconds(10)) == goincpp::runtime::ChanStatus::timeout);
+    custom->cancel();
+    BOOST_CHECK(ran->receiveFor(value, std::chrono::seconds(1)) == goincpp::runtime::ChanStatus::ok);
+    BOOST_CHECK_EQUAL(value, 1);
+    BOOST_CHECK(c->done()->receiveFor(std::chrono::seconds(1)) != goincpp::runtime::ChanStatus::timeout);
+    BOOST_CHECK(c->err() == canceledError);
+    cancel();
+}
+
+BOOST_AUTO_TEST_CASE(test_afterFunc_stop_releases) {
+    auto [c, cancel] = withCancel(background());
+    auto captured = std::make_shared<int>(0);
+    std::weak_ptr<int> weak = captured;
+    for (int i = 0; i < 10000; i++) {
+        auto stop = afterFunc(c, [captured]() {});
+        BOOST_CHECK(stop());
+    }
+    captured.reset();
+    // Stopped registrations are unlinked from c along with f.
+    BOOST_CHECK(weak.expired());
+    cancel();
+}
+
+BOOST_AUTO_TEST_CASE(test_doneFd) {
+    BOOST_CHECK_EQUAL(background()->doneFd(), -1);
+
+    auto [c, cancel] = withCancel(background());
+    auto v = withValue<RequestID>(c, "fd");
+    int fd = c->doneFd();
+    BOOST_REQUIRE(fd >= 0);
+    BOOST_CHECK_EQUAL(c->doneFd(), fd);
+    BOOST_CHECK_EQUAL(v->doneFd(), fd);
+
+    struct pollfd p = {fd, POLLIN, 0};
+    BOOST_CHECK_EQUAL(poll(&p, 1, 0), 0);
+    cancel();
+    BOOST_CHECK_EQUAL(poll(&p, 1, 1000), 1);
+    // It stays readable.
+    BOOST_CHECK_EQUAL(poll(&p, 1, 0), 1);
+
+    // Created after the fact, it starts out readable.
+    auto [d, cancelD] = withCancel(background());
+    cancelD();
+    struct pollfd q = {d->doneFd(), POLLIN, 0};
+    BOOST_CHECK_EQUAL(poll(&q, 1, 0), 1);
+}
+
+BOOST_AUTO_TEST_CASE(test_donePoller) {
+    DonePoller poller;
+    BOOST_CHECK(!poller.add(background()));
+
+    std::vector<std::shared_ptr<CancelCtx>> ctxs;
+    std::vector<CancelFunc> cancels;
+    for (int i = 0; i < 100; i++) {
+        auto [c, cancel] = withCancel(background());
+        BOOST_CHECK(poller.add(c));
+        ctxs.push_back(c);
+        cancels.push_back(cancel);
+    }
+    BOOST_CHECK_EQUAL(poller.size(), 100u);
+    BOOST_CHECK(poller.wait(std::chrono::milliseconds(0)).empty());
+
+    poller.remove(ctxs[7]);
+    cancels[7]();
+    cancels[3]();
+    cancels[42]();
+    std::vector<std::shared_ptr<Context>> done;
+    while (done.size() < 2) {
+        auto more = poller.wait(std::chrono::milliseconds(1000));
+        BOOST_REQUIRE(!more.empty());
+        done.insert(done.end(), more.begin(), more.end());
+    }
+    BOOST_CHECK_EQUAL(done.size(), 2u);
+    BOOST_CHECK(std::find(done.begin(), done.end(), ctxs[3]) != done.end());
+    BOOST_CHECK(std::find(done.begin(), done.end(), ctxs[42]) != done.end());
+    BOOST_CHECK_EQUAL(poller.size(), 97u);
+    BOOST_CHECK(poller.wait(std::chrono::milliseconds(0)).empty());
+
+    // Cancellation from another thread wakes up a blocked wait.
+    std::thread t([&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        cancels[99]();
+    });
+    done = poller.wait();
+    t.join();
+    BOOST_REQUIRE_EQUAL(done.size(), 1u);
+    BOOST_CHECK(done[0] == ctxs[99]);
+    for (auto& cancel : cancels) {
+        cancel();
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_chan_receive_ctx) {
+    auto ch = goincpp::runtime::Channel<int, 1>::make();
+    auto [c, cancel] = withCancel(background());
+
+    ch << 5;
+    int value = 0;
+    BOOST_CHECK(goincpp::context::receive(c, ch, value) == nullptr);
+    BOOST_CHECK_EQUAL(value, 5);
+
+    std::thread t([cancel = cancel]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        cancel();
+    });
+    value = 0;
+    BOOST_CHECK(goincpp::context::receive(c, ch, value) == canceledError);
+    BOOST_CHECK_EQUAL(value, 0);
+    t.join();
+
+    // A context that is never canceled just receives.
+    auto unbuffered = goincpp::runtime::Channel<int, 0>::make();
+    std::thread s([unbuffered]() { unbuffered << 7; });
+    BOOST_CHECK(goincpp::context::receive(background(), unbuffered, value) == nullptr);
+    BOOST_CHECK_EQUAL(value, 7);
+    s.join();
+
+    bool ok = true;
+    unbuffered->close();
+    BOOST_CHECK(goincpp::context::receive(background(), unbuffered, value, &ok) == nullptr);
+    BOOST_CHECK(!ok);
+}
+
+BOOST_AUTO_TEST_CASE(test_chan_send_ctx) {
+    auto ch = goincpp::runtime::Channel<std::string, 1>::make();
+    auto [c, cancel] = withTimeout(background(), std::chrono::milliseconds(10));
+    BOOST_CHECK(goincpp::context::send(c, ch, std::string("a")) == nullptr);
+    // The buffer is full until the deadline passes.
+    BOOST_CHECK(goincpp::context::send(c, ch, std::string("b")) == deadlineExceededError);
+    std::string value;
+    ch >> value;
+    BOOST_CHECK_EQUAL(value, "a");
+    BOOST_CHECK(ch->len() == 0);
+    cancel();
+}
+
+BOOST_AUTO_TEST_CASE(test_chan_signal_ctx) {
+    auto sig = goincpp::runtime::UnbufferedChannel::make();
+    auto [c, cancel] = withCancel(background());
+    std::thread t([sig]() { sig->send(); });
+    BOOST_CHECK(goincpp::context::receive(c, sig) == nullptr);
+    t.join();
+    cancel();
+    BOOST_CHECK(goincpp::context::receive(c, sig) == canceledError);
+}
+
+BOOST_AUTO_TEST_CASE(test_withDeadline_steady) {
+    auto start = std::chrono::steady_clock::now();
+    auto d = start + std::chrono::milliseconds(20);
+    auto [c, cancel] = withDeadline(background(), d);
+    BOOST_REQUIRE(c->steadyDeadline().has_value());
+    BOOST_CHECK(*c->steadyDeadline() == d);
+    // The wall-clock deadline is derived once and then stays the same.
+    auto wall = c->deadline();
+    BOOST_REQUIRE(wall.has_value());
+    BOOST_CHECK(c->deadline() == wall);
+
+    // Children see the deadline of their parent.
+    auto [child, cancelChild] = withCancel(c);
+    BOOST_CHECK(child->steadyDeadline() == d);
+    BOOST_CHECK(child->deadline() == wall);
+    // A later deadline does not extend it.
+    auto [later, cancelLater] = withDeadline(child, d + std::chrono::hours(1));
+    BOOST_CHECK(later->steadyDeadline() == d);
+
+    child->done()->receive();
+    BOOST_CHECK(std::chrono::steady_clock::now() >= d);
+    BOOST_CHECK(later->err() == deadlineExceededError);
+    cancelLater();
+    cancelChild();
+    cancel();
+}
+
+BOOST_AUTO_TEST_CASE(test_coarse_clock) {
+    using goincpp::time::CoarseClock;
+    auto coarse = CoarseClock::now();
+    auto steady = std::chrono::steady_clock::now();
+    // Coarse time lags behind.
+    BOOST_CHECK(coarse <= steady);
+    BOOST_CHECK(CoarseClock::resolution() > CoarseClock::duration::zero());
+
+    auto d = goincpp::time::deadlineAfter(std::chrono::milliseconds(5));
+    BOOST_CHECK(d >= steady + std::chrono::milliseconds(5));
+    BOOST_CHECK(!goincpp::time::expired(d));
+    std::this_thread::sleep_until(d);
+    // It catches up eventually.
+    while (!goincpp::time::expired(d)) {
+        BOOST_REQUIRE(std::chrono::steady_clock::now() - d < std::chrono::seconds(1));
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_withArena) {
+    auto root = withArena(background());
+    auto [c, cancel] = withCancel(root);
+    auto [t, cancelTimeout] = withTimeout(c, std::chrono::hours(1));
+    auto v = withValue<RequestID>(withValue<Attempt>(t, 2), "req-1");
+    auto [leaf, cancelLeaf] = withCancel(v);
+
+    BOOST_REQUIRE(root->arena() != nullptr);
+    BOOST_CHECK(background()->arena() == nullptr);
+    BOOST_CHECK(c->arena() == root->arena());
+    BOOST_CHECK(t->arena() == root->arena());
+    BOOST_CHECK(leaf->arena() == root->arena());
+    BOOST_CHECK_EQUAL(*valueOf<RequestID>(leaf), "req-1");
+    BOOST_CHECK_EQUAL(*valueOf<Attempt>(leaf), 2);
+    BOOST_CHECK(leaf->steadyDeadline() == t->steadyDeadline());
+
+    std::weak_ptr<Context> weakLeaf = leaf;
+    std::weak_ptr<Context> weakRoot = root;
+    cancel();
+    BOOST_CHECK(t->err() == canceledError);
+    BOOST_CHECK(leaf->err() == canceledError);
+
+    // Canceled descendants are released by their parents, and the arena
+    // goes with the last reference.
+    leaf.reset();
+    v.reset();
+    t.reset();
+    c.reset();
+    root.reset();
+    BOOST_CHECK(!weakLeaf.expired());
+    cancelLeaf = nullptr;
+    cancelTimeout = nullptr;
+    cancel = nullptr;
+    BOOST_CHECK(weakLeaf.expired());
+    BOOST_CHECK(weakRoot.expired());
+}
+
+BOOST_AUTO_TEST_CASE(test_withArena_allocations) {
+    // Warm up the singletons and the timer wheel.
+    background();
+    withTimeout(background(), std::chrono::hours(1)).second();
+
+    allocs = 0;
+    countAllocs = true;
+    do {
+        auto root = withArena(background());
+        auto [c, cancel] = withCancel(root);
+        auto [t, cancelTimeout] = withTimeout(c, std::chrono::hours(1));
+        auto v = withValue<RequestID>(withValue<Attempt>(t, 2), "req-1");
+        BOOST_CHECK(t->done() != nullptr);
+        BOOST_CHECK_EQUAL(*valueOf<RequestID>(v), "req-1");
+        countAllocs = false;
+        cancel();
+    } while(0);
+
+    // The arena, and the two cancel functions, which are std::functions
+    // owning their context.
+    BOOST_CHECK_LE(allocs, 3);
+}
+
+BOOST_AUTO_TEST_CASE(test_withArena_overflow) {
+    // Far more than fits: the rest is allocated past the arena and freed
+    // along with it.
+    auto root = withArena(background(), 64);
+    std::vector<std::pair<std::shared_ptr<CancelCtx>, CancelFunc>> chain;
+    std::shared_ptr<Context> parent = root;
+    for (int i = 0; i < 100; i++) {
+        chain.push_back(withCancel(parent));
+        parent = chain.back().first;
+        BOOST_CHECK(parent->arena() == root->arena());
+    }
+    chain.front().second();
+    BOOST_CHECK(parent->err() == canceledError);
+}
@@ -0,0 +1,252 @@
+// Copyright 2024 The Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#define BOOST_TEST_MODULE GoincppTestIoModule
+#include <boost/test/included/unit_test.hpp>
+
+#include <atomic>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "../src/io/fd.hpp"
+#include "../src/io/uring.hpp"
+
+using namespace goincpp;
+
+static std::string readAll(int fd) {
+    std::string out;
+    char buf[4096];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        out.append(buf, n);
+    }
+    return out;
+}
+
+BOOST_AUTO_TEST_CASE(test_fd_writer_write) {
+    int p[2];
+    BOOST_REQUIRE(pipe(p) == 0);
+    io::FdWriter w(p[1]);
+    std::size_t n = 0;
+    BOOST_CHECK(w.WriteString("hello ", &n) == nullptr);
+    BOOST_CHECK_EQUAL(n, 6u);
+    BOOST_CHECK(w.Write("world", 5) == nullptr);
+    close(p[1]);
+    BOOST_CHECK_EQUAL(readAll(p[0]), "hello world");
+    close(p[0]);
+}
+
+BOOST_AUTO_TEST_CASE(test_fd_writer_writev_partial) {
+    int p[2];
+    BOOST_REQUIRE(pipe(p) == 0);
+    // A small non-blocking pipe: writes come back short or with EAGAIN.
+    fcntl(p[1], F_SETPIPE_SZ, 4096);
+    fcntl(p[1], F_SETFL, fcntl(p[1], F_GETFL) | O_NONBLOCK);
+
+    // More buffers than a single writev takes.
+    constexpr int buffers = 3000;
+    std::vector<std::string> parts;
+    std::string expected;
+    for (int i = 0; i < buffers; i++) {
+        parts.push_back("header-" + std::to_string(i) + ":" + std::string(i % 300, 'a' + i % 26) + "\n");
+        expected += parts.back();
+    }
+    std::vector<iovec> iov;
+    for (auto& s : parts) {
+        iov.push_back({s.data(), s.size()});
+    }
+
+    std::string got;
+    std::thread reader([&]() { got = readAll(p[0]); });
+    io::FdWriter w(p[1]);
+    std::size_t n = 0;
+    BOOST_CHECK(w.WriteV(iov, &n) == nullptr);
+    close(p[1]);
+    reader.join();
+    close(p[0]);
+
+    BOOST_CHECK_EQUAL(n, expected.size());
+    BOOST_CHECK(got == expected);
+    for (auto& v : iov) {
+        BOOST_CHECK_EQUAL(v.iov_len, 0u);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_fd_writer_error) {
+    int p[2];
+    BOOST_REQUIRE(pipe(p) == 0);
+    close(p[1]);
+    io::FdWriter w(p[1]);
+    std::size_t n = 1;
+    auto err = w.WriteString("lost", &n);
+    BOOST_REQUIRE(err != nullptr);
+    auto sys = std::dynamic_pointer_cast<io::SyscallError>(err);
+    BOOST_REQUIRE(sys != nullptr);
+    BOOST_CHECK_EQUAL(sys->errnum(), EBADF);
+    BOOST_CHECK_EQUAL(n, 0u);
+    close(p[0]);
+}
+
+static int tempFile(int flags = O_RDWR) {
+    char path[] = "/tmp/goincpp_io_test_XXXXXX";
+    int fd = mkstemp(path);
+    BOOST_REQUIRE(fd >= 0);
+    unlink(path);
+    if (flags != O_RDWR) {
+        fcntl(fd, F_SETFL, flags);
+    }
+    return fd;
+}
+
+static std::string readFile(int fd) {
+    lseek(fd, 0, SEEK_SET);
+    return readAll(fd);
+}
+
+static void testUringWriter(bool uring) {
+    int fd = tempFile();
+    std::string expected;
+    // The drain thread only counts; Boost.Test checks stay on this thread.
+    std::size_t completed = 0;
+    std::size_t bytes = 0;
+    std::size_t failed = 0;
+    do {
+        io::UringWriterOptions options;
+        options.maxInFlight = 8;
+        options.batch = 4;
+        options.uring = uring;
+        io::UringWriter w(fd, options);
+        if (!uring) {
+            BOOST_CHECK(!w.UsesUring());
+        }
+
+        std::thread drain([&]() {
+            io::WriteCompletion c;
+            while (completed < 1000 && w.Completions()->receive(c)) {
+                if (c.err != nullptr || c.n != c.buf.size()) {
+                    failed++;
+                }
+                bytes += c.n;
+                completed++;
+                c = io::WriteCompletion();
+            }
+        });
+        for (int i = 0; i < 1000; i++) {
+            std::string line = "line " + std::to_string(i) + " " + std::string(i % 200, 'x') + "\n";
+            expected += line;
+            w.Write(io::UringWriter::Buffer(line.begin(), line.end()));
+            BOOST_CHECK(w.InFlight() <= options.maxInFlight);
+        }
+        w.Flush();
+        BOOST_CHECK_EQUAL(w.InFlight(), 0u);
+        drain.join();
+    } while(0);
+    BOOST_CHECK_EQUAL(failed, 0u);
+    BOOST_CHECK_EQUAL(completed, 1000u);
+    BOOST_CHECK_EQUAL(bytes, expected.size());
+    BOOST_CHECK(readFile(fd) == expected);
+    close(fd);
+}
+
+BOOST_AUTO_TEST_CASE(test_uring_writer) {
+    testUringWriter(true);
+}
+
+BOOST_AUTO_TEST_CASE(test_uring_writer_fallback) {
+    testUringWriter(false);
+}
+
+BOOST_AUTO_TEST_CASE(test_uring_writer_drain_after_flush) {
+    // More completions than the channel holds wait in the writer, so that
+    // Flush does not depend on anyone receiving them.
+    for (bool uring : {true, false}) {
+        int fd = tempFile();
+        const std::size_t writes = 3 * io::UringWriter::CompletionChannel::cap();
+        std::size_t completed = 0;
+        std::size_t failed = 0;
+        std::shared_ptr<io::UringWriter::CompletionChannel> completions;
+        do {
+            io::UringWriterOptions options;
+            options.maxInFlight = 4;
+            options.uring = uring;
+            io::UringWriter w(fd, options);
+            completions = w.Completions();
+            for (std::size_t i = 0; i < writes; i++) {
+                w.Write(io::UringWriter::Buffer(1, 'x'));
+            }
+            w.Flush();
+            io::WriteCompletion c;
+            while (completed < writes && completions->receive(c)) {
+                if (c.err != nullptr || c.n != 1) {
+                    failed++;
+                }
+                completed++;
+            }
+        } while(0);
+        BOOST_CHECK_EQUAL(failed, 0u);
+        BOOST_CHECK_EQUAL(completed, writes);
+        BOOST_CHECK_EQUAL(readFile(fd), std::string(writes, 'x'));
+        // The writer closes the channel when it goes away.
+        io::WriteCompletion c;
+        BOOST_CHECK(completions->tryReceive(c) == runtime::ChanStatus::closed);
+        close(fd);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_uring_writer_callback) {
+    for (bool uring : {true, false}) {
+        int fd = tempFile();
+        std::atomic<int> completed{0};
+        std::atomic<int> failed{0};
+        io::UringWriterOptions options;
+        options.maxInFlight = 2;
+        options.uring = uring;
+        options.onComplete = [&](io::WriteCompletion c) {
+            if (c.err != nullptr) {
+                failed++;
+            }
+            completed++;
+        };
+        do {
+            io::UringWriter w(fd, options);
+            BOOST_CHECK(w.Completions() == nullptr);
+            w.WriteAt(io::UringWriter::Buffer(4, 'b'), 4);
+            w.WriteAt(io::UringWriter::Buffer(4, 'a'), 0);
+            w.Submit();
+            // The destructor flushes.
+        } while(0);
+        BOOST_CHECK_EQUAL(failed.load(), 0);
+        BOOST_CHECK_EQUAL(completed.load(), 2);
+        BOOST_CHECK_EQUAL(readFile(fd), "aaaabbbb");
+        close(fd);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_uring_writer_error) {
+    for (bool uring : {true, false}) {
+        int fd = tempFile();
+        int ro = open(("/proc/self/fd/" + std::to_string(fd)).c_str(), O_RDONLY);
+        BOOST_REQUIRE(ro >= 0);
+        Error err;
+        io::UringWriterOptions options;
+        options.uring = uring;
+        options.onComplete = [&](io::WriteCompletion c) { err = c.err; };
+        do {
+            io::UringWriter w(ro, options);
+            w.Write(io::UringWriter::Buffer(10, 'x'));
+        } while(0);
+        BOOST_REQUIRE(err != nullptr);
+        auto sys = std::dynamic_pointer_cast<io::SyscallError>(err);
+        BOOST_REQUIRE(sys != nullptr);
+        BOOST_CHECK_EQUAL(sys->errnum(), EBADF);
+        close(ro);
+        close(fd);
+    }
+}
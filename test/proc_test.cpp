@@ -0,0 +1,148 @@
+// Copyright 2024 The Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#define BOOST_TEST_MODULE GoincppTestProcModule
+#include <boost/test/included/unit_test.hpp>
+
+#include "../src/runtime/chan.hpp"
+#include "../src/runtime/select.hpp"
+#include "../src/runtime/proc.hpp"
+
+using namespace goincpp::runtime;
+
+BOOST_AUTO_TEST_CASE(test_go_many) {
+    const int count = 10000;
+    auto ch = Channel<int, 64>::make();
+    for (int i = 1; i <= count; i++) {
+        go([ch, i]() {
+            ch << i;
+        });
+    }
+
+    long sum = 0;
+    int value;
+    for (int i = 0; i < count; i++) {
+        ch >> value;
+        sum += value;
+    }
+    BOOST_CHECK_EQUAL(sum, long(count) * (count + 1) / 2);
+}
+
+BOOST_AUTO_TEST_CASE(test_go_pingpong) {
+    auto ping = Channel<int, 0>::make();
+    auto pong = Channel<int, 0>::make();
+    auto done = Channel<int, 1>::make();
+    const int rounds = 10000;
+
+    go([ping, pong]() {
+        int value;
+        for (int i = 0; i < rounds; i++) {
+            ping >> value;
+            pong << value + 1;
+        }
+    });
+    go([ping, pong, done]() {
+        int value = 0;
+        for (int i = 0; i < rounds; i++) {
+            ping << value;
+            pong >> value;
+        }
+        done << value;
+    });
+
+    int value;
+    done >> value;
+    BOOST_CHECK_EQUAL(value, rounds);
+}
+
+BOOST_AUTO_TEST_CASE(test_go_blocked_goroutines) {
+    // Far more goroutines blocked at once than there are workers.
+    const int count = 5000;
+    auto in = Channel<int, 0>::make();
+    auto done = UnbufferedChannel::make();
+    auto out = Channel<int, 64>::make();
+    for (int i = 0; i < count; i++) {
+        go([in, done, out]() {
+            int value = 0;
+            if (select(caseRecv(in, value), caseRecv(done)) == 0) {
+                out << value;
+            } else {
+                out << -1;
+            }
+        });
+    }
+    for (int i = 1; i <= count / 2; i++) {
+        in << i;
+    }
+    done->close();
+
+    long sum = 0;
+    int canceled = 0;
+    int value;
+    for (int i = 0; i < count; i++) {
+        out >> value;
+        if (value < 0) {
+            canceled++;
+        } else {
+            sum += value;
+        }
+    }
+    BOOST_CHECK_EQUAL(sum, long(count / 2) * (count / 2 + 1) / 2);
+    BOOST_CHECK_EQUAL(canceled, count - count / 2);
+}
+
+BOOST_AUTO_TEST_CASE(test_go_spawn_from_goroutine) {
+    // Goroutines started by a goroutine go to its local queue, which
+    // overflows into the global queue and is stolen from by idle workers.
+    const int count = 5000;
+    auto out = Channel<int, 16>::make();
+    go([out]() {
+        for (int i = 0; i < count; i++) {
+            go([out]() {
+                gosched();
+                out << 1;
+            });
+        }
+    });
+
+    int total = 0;
+    int value;
+    for (int i = 0; i < count; i++) {
+        out >> value;
+        total += value;
+    }
+    BOOST_CHECK_EQUAL(total, count);
+}
+
+BOOST_AUTO_TEST_CASE(test_go_timed) {
+    auto ch = Channel<int, 1>::make();
+    auto out = Channel<long, 2>::make();
+
+    go([ch, out]() {
+        int value;
+        auto start = std::chrono::steady_clock::now();
+        auto status = ch->receiveFor(value, std::chrono::milliseconds(20));
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        out << (status == ChanStatus::timeout && elapsed >= std::chrono::milliseconds(20) ? 1L : 0L);
+        status = ch->receiveFor(value, std::chrono::seconds(10));
+        out << (status == ChanStatus::ok ? long(value) : -1L);
+    });
+
+    long result;
+    out >> result;
+    BOOST_CHECK_EQUAL(result, 1);
+    ch << 7;
+    out >> result;
+    BOOST_CHECK_EQUAL(result, 7);
+}
+
+BOOST_AUTO_TEST_CASE(test_go_executor) {
+    auto out = Channel<int, 1>::make();
+    scheduler().post([out]() {
+        out << 1;
+    });
+    int value;
+    out >> value;
+    BOOST_CHECK_EQUAL(value, 1);
+}
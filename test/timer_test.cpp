@@ -0,0 +1,308 @@
+// Copyright 2024 The Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#define BOOST_TEST_MODULE GoincppTestTimerModule
+#include <boost/test/included/unit_test.hpp>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "../src/runtime/park.hpp"
+#include "../src/time/tick.hpp"
+#include "../src/time/timer.hpp"
+
+using namespace goincpp::time;
+using goincpp::runtime::ChanStatus;
+using goincpp::runtime::Parker;
+using Clock = std::chrono::steady_clock;
+
+BOOST_AUTO_TEST_CASE(test_timer_fires) {
+    Timer t;
+    Parker p;
+    auto start = std::chrono::steady_clock::now();
+    t.start(std::chrono::milliseconds(10), [&p]() { p.unpark(); });
+    BOOST_CHECK(t.isRunning());
+    p.park();
+    BOOST_CHECK(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(10));
+    BOOST_CHECK(!t.isRunning());
+    BOOST_CHECK(!t.stop());
+}
+
+BOOST_AUTO_TEST_CASE(test_timer_stop) {
+    std::atomic<int> fired{0};
+    Timer t;
+    t.start(std::chrono::milliseconds(10), [&fired]() { fired++; });
+    BOOST_CHECK(t.stop());
+    BOOST_CHECK(!t.isRunning());
+    BOOST_CHECK(!t.stop());
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    BOOST_CHECK_EQUAL(fired.load(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_timer_restart) {
+    std::atomic<int> first{0};
+    std::atomic<int> second{0};
+    Parker p;
+    Timer t;
+    t.start(std::chrono::milliseconds(5), [&first]() { first++; });
+    t.start(std::chrono::milliseconds(10), [&second, &p]() { second++; p.unpark(); });
+    p.park();
+    BOOST_CHECK_EQUAL(first.load(), 0);
+    BOOST_CHECK_EQUAL(second.load(), 1);
+}
+
+BOOST_AUTO_TEST_CASE(test_timer_order) {
+    constexpr int n = 20;
+    std::mutex mu;
+    std::vector<int> order;
+    Parker p;
+    std::vector<std::unique_ptr<Timer>> timers;
+    for (int i = n - 1; i >= 0; i--) {
+        timers.push_back(std::make_unique<Timer>());
+        timers.back()->start(std::chrono::milliseconds(2 * i + 1), [&, i]() {
+            std::lock_guard<std::mutex> lock(mu);
+            order.push_back(i);
+            if (static_cast<int>(order.size()) == n) {
+                p.unpark();
+            }
+        });
+    }
+    p.park();
+    for (int i = 0; i < n; i++) {
+        BOOST_CHECK_EQUAL(order[i], i);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_timer_cascade) {
+    // Beyond the 256 ticks of the first level of the wheel.
+    Timer t;
+    Parker p;
+    auto start = std::chrono::steady_clock::now();
+    t.start(std::chrono::milliseconds(600), [&p]() { p.unpark(); });
+    p.park();
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    BOOST_CHECK(elapsed >= std::chrono::milliseconds(600));
+    BOOST_CHECK(elapsed < std::chrono::milliseconds(900));
+}
+
+// fakeOffset moves fakeNow, the clock of the wheel of test_timer_far_future,
+// ahead of the steady clock.
+static std::atomic<Clock::rep> fakeOffset{0};
+
+static Clock::time_point fakeNow() {
+    return Clock::now() + Clock::duration(fakeOffset.load());
+}
+
+BOOST_AUTO_TEST_CASE(test_timer_far_future) {
+    using namespace std::chrono_literals;
+    TimerWheel wheel(&fakeNow);
+    auto start = fakeNow();
+    std::atomic<int> fired{0};
+    std::atomic<int> firedMax{0};
+    TimerWheel::Node far;
+    TimerWheel::Node max;
+    TimerWheel::Node wake;
+    TimerWheel::Node check;
+    Parker p;
+    Parker pFar;
+    // Beyond the 2^32 ticks, about 49.7 days, that the wheel reaches.
+    wheel.add(&far, start + 24h * 60, [&fired, &pFar]() { fired++; pFar.unpark(); });
+    wheel.add(&max, Clock::time_point::max(), [&firedMax]() { firedMax++; });
+
+    // Past the reach of the wheel, but short of the deadline. A timer due
+    // at once wakes the wheel, which catches up on the skipped days and
+    // runs what is due in order: anything fired early runs before check.
+    fakeOffset = Clock::duration(24h * 50).count();
+    wheel.add(&check, start + 24h * 50, [&p]() { p.unpark(); });
+    wheel.add(&wake, start, []() {});
+    p.park();
+    BOOST_CHECK_EQUAL(fired.load(), 0);
+    BOOST_CHECK(wheel.pending(&far));
+
+    fakeOffset = Clock::duration(24h * 60 + 1s).count();
+    wheel.add(&wake, start, []() {});
+    pFar.park();
+    BOOST_CHECK_EQUAL(fired.load(), 1);
+    BOOST_CHECK(!wheel.pending(&far));
+    BOOST_CHECK_EQUAL(firedMax.load(), 0);
+    BOOST_CHECK(wheel.remove(&max));
+}
+
+BOOST_AUTO_TEST_CASE(test_timer_many) {
+    constexpr int n = 10000;
+    std::atomic<int> fired{0};
+    Parker p;
+    std::vector<std::unique_ptr<Timer>> timers(n);
+    for (int i = 0; i < n; i++) {
+        timers[i] = std::make_unique<Timer>();
+        timers[i]->start(std::chrono::milliseconds(10 + i % 50), [&]() {
+            if (fired.fetch_add(1) + 1 == n / 2) {
+                p.unpark();
+            }
+        });
+        // Stop every other one; the rest still fire.
+        if (i % 2 == 0) {
+            BOOST_CHECK(timers[i]->stop());
+        }
+    }
+    p.park();
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    BOOST_CHECK_EQUAL(fired.load(), n / 2);
+}
+
+BOOST_AUTO_TEST_CASE(test_timer_stop_from_callback) {
+    auto t = std::make_shared<Timer>();
+    Parker p;
+    std::atomic<bool> stopped{true};
+    t->start(std::chrono::milliseconds(1), [t, &p, &stopped]() {
+        stopped = t->stop();
+        p.unpark();
+    });
+    p.park();
+    BOOST_CHECK(!stopped.load());
+}
+
+BOOST_AUTO_TEST_CASE(test_newTimer) {
+    auto start = Clock::now();
+    auto t = newTimer(std::chrono::milliseconds(10));
+    Clock::time_point fired;
+    t->channel()->receive(fired);
+    BOOST_CHECK(fired - start >= std::chrono::milliseconds(10));
+    BOOST_CHECK(!t->stop());
+
+    // Reset rearms an expired timer.
+    BOOST_CHECK(!t->reset(std::chrono::milliseconds(5)));
+    BOOST_CHECK(t->channel()->receiveFor(fired, std::chrono::seconds(1)) == ChanStatus::ok);
+
+    // Reset of an active timer postpones it.
+    t->reset(std::chrono::milliseconds(5));
+    BOOST_CHECK(t->reset(std::chrono::milliseconds(30)));
+    BOOST_CHECK(t->channel()->receiveFor(fired, std::chrono::milliseconds(15)) == ChanStatus::timeout);
+    BOOST_CHECK(t->channel()->receiveFor(fired, std::chrono::seconds(1)) == ChanStatus::ok);
+}
+
+BOOST_AUTO_TEST_CASE(test_newTimer_stop_drains) {
+    auto t = newTimer(std::chrono::milliseconds(1));
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    BOOST_CHECK(!t->stop());
+    Clock::time_point fired;
+    BOOST_CHECK(t->channel()->tryReceive(fired) != ChanStatus::ok);
+
+    Timer plain;
+    BOOST_CHECK_THROW(plain.reset(std::chrono::milliseconds(1)), std::logic_error);
+}
+
+BOOST_AUTO_TEST_CASE(test_after) {
+    auto start = Clock::now();
+    auto c = after(std::chrono::milliseconds(10));
+    Clock::time_point fired;
+    c->receive(fired);
+    BOOST_CHECK(fired - start >= std::chrono::milliseconds(10));
+}
+
+BOOST_AUTO_TEST_CASE(test_ticker) {
+    auto start = Clock::now();
+    auto t = newTicker(std::chrono::milliseconds(10));
+    Clock::time_point tick;
+    for (int i = 1; i <= 10; i++) {
+        t->channel()->receive(tick);
+    }
+    // Ticks do not drift: the tenth is due 100ms after the start.
+    auto elapsed = tick - start;
+    BOOST_CHECK(elapsed >= std::chrono::milliseconds(100));
+    BOOST_CHECK(elapsed < std::chrono::milliseconds(150));
+
+    t->stop();
+    BOOST_CHECK(t->channel()->receiveFor(tick, std::chrono::milliseconds(30)) == ChanStatus::timeout);
+
+    t->reset(std::chrono::milliseconds(5));
+    BOOST_CHECK(t->channel()->receiveFor(tick, std::chrono::seconds(1)) == ChanStatus::ok);
+    BOOST_CHECK_THROW(newTicker(std::chrono::milliseconds(0)), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(test_ticker_skips_missed) {
+    auto start = Clock::now();
+    Ticker t(std::chrono::milliseconds(10));
+    // Hold up the timer thread across three ticks.
+    Timer blocker;
+    blocker.start(std::chrono::milliseconds(5), []() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    });
+
+    Clock::time_point first, second;
+    t.channel()->receive(first);
+    t.channel()->receive(second);
+    BOOST_CHECK(first - start >= std::chrono::milliseconds(35));
+    // No burst of the missed ticks: the next one is back on the grid.
+    BOOST_CHECK(second - start >= std::chrono::milliseconds(40));
+}
+
+BOOST_AUTO_TEST_CASE(test_ticker_many) {
+    constexpr int n = 2000;
+    std::vector<std::shared_ptr<Ticker>> tickers;
+    for (int i = 0; i < n; i++) {
+        tickers.push_back(newTicker(std::chrono::milliseconds(5 + i % 10)));
+    }
+    Clock::time_point tick;
+    for (int round = 0; round < 3; round++) {
+        for (auto& t : tickers) {
+            BOOST_REQUIRE(t->channel()->receiveFor(tick, std::chrono::seconds(1)) == ChanStatus::ok);
+        }
+    }
+    for (int i = 0; i < n; i += 2) {
+        tickers[i]->stop();
+    }
+    tickers.clear();
+}
+
+BOOST_AUTO_TEST_CASE(test_latency_buckets) {
+    for (uint64_t ns : {0ull, 1ull, 7ull, 8ull, 15ull, 16ull, 17ull, 1000ull, 999999ull, 123456789ull}) {
+        int i = LatencyBuckets::index(ns);
+        BOOST_REQUIRE(i >= 0 && i < LatencyBuckets::count);
+        uint64_t upper = LatencyBuckets::upperBound(i);
+        BOOST_CHECK(upper >= ns);
+        BOOST_CHECK(upper - ns <= ns / LatencyBuckets::subBuckets);
+        if (i > 0) {
+            BOOST_CHECK(LatencyBuckets::upperBound(i - 1) < ns);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_timer_stats) {
+    constexpr int n = 100;
+    auto before = timerStats();
+    std::atomic<int> fired{0};
+    Parker p;
+    std::vector<std::unique_ptr<Timer>> timers(n);
+    for (int i = 0; i < n; i++) {
+        timers[i] = std::make_unique<Timer>();
+        timers[i]->start(std::chrono::milliseconds(5), [&]() {
+            if (fired.fetch_add(1) + 1 == n - n / 4) {
+                p.unpark();
+            }
+        });
+    }
+    BOOST_CHECK(timerStats().outstanding >= before.outstanding + n);
+    for (int i = 0; i < n / 4; i++) {
+        BOOST_CHECK(timers[i]->stop());
+    }
+    p.park();
+
+    auto after = timerStats();
+    BOOST_CHECK(after.fired - before.fired >= n - n / 4);
+    BOOST_CHECK(after.canceled - before.canceled >= n / 4);
+    auto p50 = after.percentile(0.5);
+    auto p99 = after.percentile(0.99);
+    BOOST_CHECK(p50 <= p99);
+    BOOST_CHECK(p99 <= after.maxLateness);
+    // Rounding up to the next tick alone makes some lateness.
+    BOOST_CHECK(after.maxLateness > std::chrono::nanoseconds(0));
+    BOOST_CHECK(p50 < std::chrono::seconds(1));
+
+    TimerStatsSnapshot empty;
+    BOOST_CHECK(empty.percentile(0.99) == std::chrono::nanoseconds(0));
+}